@@ -19,9 +19,112 @@
 #define P3_PAGER_PRIORITY   2
 
 /*
- * Swap disk.
+ * Frame zeroing daemon. It runs at the lowest priority and keeps up to
+ * P3_ZERO_RESERVE free frames zeroed for first-touch faults.
+ */
+#define P3_ZERO_PRIORITY    5
+#define P3_ZERO_RESERVE     4
+
+/*
+ * Maximum # of pages read ahead after a sequential fault.
+ */
+#define P3_READAHEAD_MAX    8
+
+/*
+ * Maximum # of pages written to swap in one clustered write.
+ */
+#define P3_CLUSTER_MAX      8
+
+/*
+ * Write-behind cleaner. When fewer than P3_CLEAN_LOW percent of the frames
+ * are free or clean it writes dirty, unreferenced pages to swap until
+ * P3_CLEAN_HIGH percent are. Override the watermarks with -D.
+ */
+#define P3_CLEANER_PRIORITY 4
+#ifndef P3_CLEAN_LOW
+#define P3_CLEAN_LOW        10
+#endif
+#ifndef P3_CLEAN_HIGH
+#define P3_CLEAN_HIGH       25
+#endif
+
+/*
+ * Same-page merger. When memory is short, at most once every
+ * P3_MERGE_INTERVAL faults, it looks for identical resident pages and
+ * shares one read-only frame between them until one is written.
+ * -DP3_MERGE_INTERVAL=0 turns it off.
+ */
+#define P3_MERGE_PRIORITY   5
+#ifndef P3_MERGE_INTERVAL
+#define P3_MERGE_INTERVAL   64
+#endif
+
+/*
+ * Daemon that resumes processes suspended by load control once nothing
+ * else is faulting. It runs at the lowest priority, but user processes
+ * can too, so it also waits until there have been no faults for
+ * P3_RESUME_QUIET microseconds.
+ */
+#define P3_RESUME_PRIORITY  5
+#ifndef P3_RESUME_QUIET
+#define P3_RESUME_QUIET     100000
+#endif
+
+/*
+ * # frames the replacement policies look at past an unreferenced dirty
+ * victim for a clean one, which can be replaced without a write. WSClock
+ * always prefers clean pages and leaves the dirty ones to the cleaner.
+ */
+#ifndef P3_CLEAN_WINDOW
+#define P3_CLEAN_WINDOW     8
+#endif
+
+/*
+ * Compressed swap cache, as a percentage of physical memory. Evicted pages
+ * are compressed into it and only written to the swap disk when it is
+ * full. -DP3_ZPOOL_PERCENT=0 turns it off.
+ */
+#ifndef P3_ZPOOL_PERCENT
+#define P3_ZPOOL_PERCENT    20
+#endif
+
+/*
+ * Page-fault-frequency frame allocation. A process's resident-set target
+ * grows when it faults again within P3_PFF_FAST microseconds of its own
+ * CPU time, and shrinks when it has run for more than P3_PFF_SLOW since
+ * its last fault.
+ */
+#ifndef P3_PFF_FAST
+#define P3_PFF_FAST         2000
+#endif
+#ifndef P3_PFF_SLOW
+#define P3_PFF_SLOW         20000
+#endif
+
+/*
+ * Page replacement policies. P3_vmPolicy picks one at P3_VmInit time; it
+ * defaults to P3_POLICY, which can be set with -D.
+ */
+#define P3_POLICY_CLOCK     0
+#define P3_POLICY_WSCLOCK   1
+#define P3_POLICY_CLOCKPRO  2
+#define P3_POLICY_ARC       3
+#define P3_POLICY_AGING     4
+#define P3_NUM_POLICIES     5
+#ifndef P3_POLICY
+#define P3_POLICY           P3_POLICY_CLOCK
+#endif
+
+/*
+ * Swap disks. Swap is striped across the disk units in P3_SWAP_DISKS,
+ * which defaults to just P3_SWAP_DISK. The units must all have the same
+ * sector and track sizes. -DP3_SWAP_DISKS="{0,1}" stripes swap across
+ * both USLOSS disks.
  */
 #define P3_SWAP_DISK 1
+#ifndef P3_SWAP_DISKS
+#define P3_SWAP_DISKS {P3_SWAP_DISK}
+#endif
 
 /*
  * Paging statistics
@@ -37,9 +140,23 @@ typedef struct P3_VmStats {
     int pageIns;    /* # faults that required reading page from disk */
     int pageOuts;   /* # faults that required writing a page to disk */
     int replaced;   /* # pages replaced */
+    int cleaned;    /* # dirty pages written back by the cleaner */
+    int prefetched; /* # pages read ahead of a fault */
+    int prefetchHits;   /* # prefetched pages that were used */
+    int prefetchMisses; /* # prefetched pages that weren't */
+    int clustered;  /* # dirty pages written along with an evicted page */
+    int poolStores; /* # evicted pages compressed into the swap cache */
+    int poolBytes;  /* # bytes those pages compressed to */
+    int poolHits;   /* # pages swapped in from the swap cache */
+    int poolMisses; /* # pages swapped in from the disk instead */
+    int suspended;  /* # times a process was suspended to stop thrashing */
+    int merged;     /* # pages merged onto an identical page */
+    int largestFree;    /* longest run of free blocks, when swap was most fragmented */
+    int fragFree;       /* # of free blocks at that time */
 } P3_VmStats;
 
 extern P3_VmStats P3_vmStats;
+extern int P3_vmPolicy;
 
 /*
  * Error codes
@@ -56,12 +173,16 @@ extern P3_VmStats P3_vmStats;
 #define P3_NOT_INITIALIZED          -38
 #define P3_OUT_OF_PAGES             -39
 #define P3_INVALID_FRAME            -40
+#define P3_INVALID_POLICY           -41
+#define P3_INVALID_SWAP_DISK        -42
 
 #ifndef CHECKRETURN
 #define CHECKRETURN __attribute__((warn_unused_result))
 #endif
 
 extern int          P3_VmInit(int mappings, int pages, int frames, int pagers) CHECKRETURN;
+extern int          P3_VmSetLimit(int pid, int frames) CHECKRETURN;
+extern int          P3_VmClone(int parent, int child) CHECKRETURN;
 extern void         P3_VmDestroy(void);
 extern  USLOSS_PTE  *P3_AllocatePageTable(int pid) CHECKRETURN;
 extern  void        P3_FreePageTable(int pid);
@@ -37,11 +37,36 @@ USLOSS_PTE *P3PageTableAllocateEmpty(int numPages) CHECKRETURN;
 
 // Phase 3c
 
+// Frame descriptors, one per frame, shared by phase 3c and phase 3d.
+// P3FrameInit allocates the table. Phase 3c owns used and mapPage, phase
+// 3d owns the fields that describe the page in the frame.
+
+typedef struct P3Sharer{
+    PID pid;
+    int page;
+    struct P3Sharer *next;
+}P3Sharer;
+
+typedef struct P3Frame{
+    int used;       // not on a free list
+    int mapPage;    // page P3FrameMap mapped the frame to, -1 if none
+    PID pid;        // process whose page is in the frame, -1 if none
+    int page;
+    int busy;       // a pager is moving a page into or out of the frame
+    int refs;       // # pages mapped to the frame, 0 if none
+    P3Sharer *sharers;  // copy-on-write pages in the frame other than pid's
+}P3Frame;
+
+extern P3Frame *P3_frameTable;
+
 int         P3FrameInit(int pages, int frames) CHECKRETURN;
 int         P3FrameShutdown(void) CHECKRETURN;
 int         P3FrameFreeAll(PID pid) CHECKRETURN;
 int         P3FrameMap(int frame, void **addr) CHECKRETURN;
 int         P3FrameUnmap(int frame) CHECKRETURN;
+int         P3FrameMapRun(int count, int *frames, void **addr) CHECKRETURN;
+int         P3FrameRelease(int frame) CHECKRETURN;
+int         P3FrameTake(int *frame) CHECKRETURN;
 
 int         P3PagerInit(int pages, int frames, int pagers) CHECKRETURN;
 int         P3PagerShutdown(void)  CHECKRETURN;
@@ -53,5 +78,21 @@ int         P3SwapShutdown(void) CHECKRETURN;
 int         P3SwapFreeAll(PID pid) CHECKRETURN;
 int         P3SwapOut(int *frame) CHECKRETURN;
 int         P3SwapIn(PID pid, int page, int frame) CHECKRETURN;
+int         P3SwapInAhead(PID pid, int page, int frame) CHECKRETURN;
+int         P3SwapHasPage(PID pid, int page) CHECKRETURN;
+int         P3SwapAdmit(PID pid) CHECKRETURN;
+int         P3SwapSetLimit(PID pid, int frames) CHECKRETURN;
+int         P3SwapAtLimit(PID pid) CHECKRETURN;
+int         P3SwapOutLocal(PID pid, int *frame) CHECKRETURN;
+int         P3SwapDropFrame(PID pid, int page) CHECKRETURN;
+int         P3SwapClone(PID parent, PID child) CHECKRETURN;
+int         P3SwapCowCheck(PID pid, int page) CHECKRETURN;
+int         P3SwapCowCopy(PID pid, int page, int frame) CHECKRETURN;
+int         P3SwapWake(void) CHECKRETURN;
+
+// P3SwapCowCheck results
+#define P3_COW_NONE     0   // not copy-on-write
+#define P3_COW_PRIVATE  1   // was copy-on-write, no longer shared
+#define P3_COW_SHARED   2   // shared, copy it before writing
 
 #endif
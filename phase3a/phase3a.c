@@ -18,6 +18,7 @@ static int	numPages = 0; // # of pages in a page table
 static int numFrames = 0; // # of frames in physical memory
 
 P3_VmStats	P3_vmStats;
+int         P3_vmPolicy = P3_POLICY;
 
 static USLOSS_PTE  *PageTableAllocateIdentity(int pages);
 
@@ -73,6 +74,9 @@ P3_VmInit(int unused, int pages, int frames, int pagers)
 
     USLOSS_IntVec[USLOSS_MMU_INT] = P3PageFaultHandler;
 
+    // clear the stats first, the init functions below fill some of them in
+    memset((char *) &P3_vmStats, 0, sizeof(P3_vmStats));
+
     result = MMUInit(pages, frames);
     if (result != P1_SUCCESS) {
         USLOSS_Console("MMUInit failed: %d\n", result);
@@ -99,7 +103,6 @@ P3_VmInit(int unused, int pages, int frames, int pagers)
 
     numPages = pages;
     numFrames = frames;
-    memset((char *) &P3_vmStats, 0, sizeof(P3_vmStats));
     P3_vmStats.pages = pages;
     P3_vmStats.frames = frames;
     initialized = TRUE;
@@ -107,6 +110,94 @@ P3_VmInit(int unused, int pages, int frames, int pagers)
 done:
     return result;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmSetLimit --
+ *
+ *	Limits the # of frames a process can hold. A process at its limit
+ *	replaces its own pages instead of taking frames from others. The
+ *	limit goes away when the process quits.
+ *
+ * Parameters:
+ *      pid: the process
+ *      frames: max # of frames, 0 for no limit
+ *
+ * Results:
+ *      P3_NOT_INITIALIZED: the VM system has not been initialized
+ *      P1_INVALID_PID: pid is invalid
+ *      P3_INVALID_NUM_FRAMES: frames is negative
+ *      P1_SUCCESS: success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmSetLimit(int pid, int frames)
+{
+    int     result = P1_SUCCESS;
+
+    CheckMode();
+
+    if (!initialized) {
+        result = P3_NOT_INITIALIZED;
+        goto done;
+    }
+    if ((pid < 0) || (pid >= P1_MAXPROC)) {
+        result = P1_INVALID_PID;
+        goto done;
+    }
+    if (frames < 0) {
+        result = P3_INVALID_NUM_FRAMES;
+        goto done;
+    }
+    result = P3SwapSetLimit(pid, frames);
+done:
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3_VmClone --
+ *
+ *	Gives the child a copy of the parent's VM region. The pages are
+ *	shared copy-on-write, so nothing is copied until one of the
+ *	processes writes a page.
+ *
+ * Parameters:
+ *      parent: the process whose pages are copied
+ *      child: a process that has a page table but hasn't touched
+ *             any pages yet
+ *
+ * Results:
+ *      P3_NOT_INITIALIZED: the VM system has not been initialized
+ *      P1_INVALID_PID: a pid is invalid, a process has no page table,
+ *                      or the child already has pages
+ *      P1_SUCCESS: success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3_VmClone(int parent, int child)
+{
+    int     result = P1_SUCCESS;
+
+    CheckMode();
+
+    if (!initialized) {
+        result = P3_NOT_INITIALIZED;
+        goto done;
+    }
+    if ((parent < 0) || (parent >= P1_MAXPROC) || (child < 0) || (child >= P1_MAXPROC) ||
+        (pageTables[parent] == NULL) || (pageTables[child] == NULL)) {
+        result = P1_INVALID_PID;
+        goto done;
+    }
+    result = P3SwapClone(parent, child);
+done:
+    return result;
+}
 /*
  *----------------------------------------------------------------------
  *
@@ -385,10 +476,37 @@ P3_PrintStats(P3_VmStats *stats)
     USLOSS_Console("\tblocks:\t\t%d\n", stats->blocks);
     USLOSS_Console("\tfreeFrames:\t%d\n", stats->freeFrames);
     USLOSS_Console("\tfreeBlocks:\t%d\n", stats->freeBlocks);
+    USLOSS_Console("\tlargestFree:\t%d\n", stats->largestFree);
+    USLOSS_Console("\tfragFree:\t%d\n", stats->fragFree);
+    if (stats->fragFree > 0) {
+        // how much of the free swap space wasn't in the largest free run
+        USLOSS_Console("\tfragmentation:\t%d%%\n",
+                       100 - (100 * stats->largestFree) / stats->fragFree);
+    }
     USLOSS_Console("\tfaults:\t\t%d\n", stats->faults);
     USLOSS_Console("\tnew:\t\t%d\n", stats->new);
     USLOSS_Console("\tpageIns:\t%d\n", stats->pageIns);
     USLOSS_Console("\tpageOuts:\t%d\n", stats->pageOuts);
     USLOSS_Console("\treplaced:\t%d\n", stats->replaced);
+    USLOSS_Console("\tcleaned:\t%d\n", stats->cleaned);
+    USLOSS_Console("\tprefetched:\t%d\n", stats->prefetched);
+    USLOSS_Console("\tprefetchHits:\t%d\n", stats->prefetchHits);
+    USLOSS_Console("\tprefetchMisses:\t%d\n", stats->prefetchMisses);
+    USLOSS_Console("\tclustered:\t%d\n", stats->clustered);
+    USLOSS_Console("\tpoolStores:\t%d\n", stats->poolStores);
+    USLOSS_Console("\tpoolBytes:\t%d\n", stats->poolBytes);
+    USLOSS_Console("\tpoolHits:\t%d\n", stats->poolHits);
+    USLOSS_Console("\tpoolMisses:\t%d\n", stats->poolMisses);
+    if (stats->poolHits + stats->poolMisses > 0) {
+        USLOSS_Console("\tpoolHitRate:\t%d%%\n",
+                       (100 * stats->poolHits) / (stats->poolHits + stats->poolMisses));
+    }
+    if (stats->poolBytes > 0) {
+        // uncompressed size / compressed size, times 100
+        USLOSS_Console("\tpoolRatio:\t%d%%\n",
+                       (int) ((100LL * stats->poolStores * USLOSS_MmuPageSize()) / stats->poolBytes));
+    }
+    USLOSS_Console("\tsuspended:\t%d\n", stats->suspended);
+    USLOSS_Console("\tmerged:\t\t%d\n", stats->merged);
 }
 
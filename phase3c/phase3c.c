@@ -34,11 +34,27 @@ static int pagerInitialized = FALSE;
 static int  numPages = 0; // # of pages in a page table
 static int numFrames = 0; // # of frames in physical memory
 
-typedef struct Frame{
-    int id;
-    int used;
-}Frame;
-static Frame * framesTable = NULL;
+P3Frame *P3_frameTable = NULL;
+
+// Pools of free frames, kept as stacks of frame numbers so that allocating
+// and freeing a frame is O(1). Frames on zeroList have been zeroed by the
+// zeroing daemon, frames on freeList hold whatever was there before.
+// P3_vmStats.freeFrames is numFree + numZeroed + numZeroing.
+static int *freeList = NULL;
+static int numFree = 0;
+static int *zeroList = NULL;
+static int numZeroed = 0;
+static int numZeroing = 0;  // taken off freeList by the daemon, not yet on zeroList
+static int frameMutex;
+
+static int  FrameAlloc(int wantZero, int *zeroed);
+static void FrameFree(int frame);
+
+static int zeroPID;
+static int zeroWork;        // the daemon waits here for frames to zero
+static int zeroDone;        // P3PagerShutdown waits here for the daemon to quit
+static int zeroIdle = FALSE;
+static int Zeroer(void *arg);
 
 // information about a fault. Add to this as necessary.
 
@@ -49,11 +65,64 @@ typedef struct Fault {
     SID         wait;
     // other stuff goes here
     int         rc;
+    struct Fault *next; // next fault waiting on the same in-flight page
+    int         exiting;    // process is quitting, don't start any reads for it
 } Fault;
 
-static Fault faultQueue[P1_MAXPROC];
-static int qFront = 0;
-static int qRear = 0;
+// One fault record per process, indexed by pid. A process has at most one
+// fault outstanding, so its record (and the wait semaphore in it, which is
+// created once in P3PagerInit) is never shared. The faulting process
+// reads its result from its own record.
+static Fault faults[P1_MAXPROC];
+
+// Faults waiting for a pager, as pids. A pager claims the fault at the
+// front; claimed faults are completed in whatever order the pagers finish.
+static PID pending[P1_MAXPROC];
+static int qFront = 0;  // next fault for a pager to claim
+static int qRear = 0;   // where the next fault goes
+
+// Pages a pager is currently bringing in. A fault on a page that is already
+// in flight is attached to the existing operation instead of allocating
+// another frame and swap slot, and is woken when the operation completes.
+// Protected by pagerMutex.
+
+typedef struct Inflight {
+    PID     pid;        // -1 if the entry is unused
+    int     page;
+    Fault   *waiters;   // faults to wake, chained through Fault.next
+} Inflight;
+
+// one per faulting process plus a readahead read per pager
+#define MAX_INFLIGHT (P1_MAXPROC+P3_MAX_PAGERS)
+
+static Inflight inflight[MAX_INFLIGHT];
+static int inflightDone;        // processes waiting for in-flight pages to drain
+static int inflightWaiters = 0;
+
+static Inflight *InflightFind(PID pid, int page);
+static Inflight *InflightStart(PID pid, int page);
+static void      InflightComplete(Inflight *op, int rc);
+
+// Per-process readahead state, protected by pagerMutex. A fault on the page
+// after the previous fault, or right after the last prefetched window, is
+// sequential and the pager reads the next `window` pages that are on swap
+// into free frames. At the process's next fault the window is scored: a
+// prefetched page that is still mapped and has been referenced is a hit.
+// The window doubles when every page hit and halves when fewer than half did.
+
+typedef struct Readahead {
+    int lastPage;   // page of the previous fault, -1 if none
+    int window;     // # of pages to read ahead
+    int start;      // first page of the last window
+    int size;       // # of pages in the last window
+    int mask;       // bit i set if start+i was prefetched
+} Readahead;
+
+static Readahead readahead[P1_MAXPROC];
+
+static int  ReadaheadCheck(PID pid, int page);
+static void ReadaheadFill(Fault *fault, int page, int count);
+static int  CowFault(Fault *fault, int page);
 
 static int numPagers;
 static int *pagerPID;
@@ -90,12 +159,25 @@ P3FrameInit(int pages, int frames)
     // set P3_vmStats.freeFrames
     numPages=pages;
     numFrames=frames;
-    framesTable = malloc(sizeof(Frame)*numFrames);
-    for(int i=0;i<frames;i++){
-        framesTable[i].id=i;
-        framesTable[i].used=FALSE;
+    P3_frameTable = malloc(sizeof(P3Frame)*numFrames);
+    freeList = malloc(sizeof(int)*numFrames);
+    zeroList = malloc(sizeof(int)*numFrames);
+    numFree = 0;
+    numZeroed = 0;
+    numZeroing = 0;
+    // push in reverse so that frame 0 is handed out first
+    for(int i=frames-1;i>=0;i--){
+        P3_frameTable[i].used=FALSE;
+        P3_frameTable[i].mapPage=-1;
+        P3_frameTable[i].pid=-1;
+        P3_frameTable[i].page=-1;
+        P3_frameTable[i].busy=FALSE;
+        P3_frameTable[i].refs=0;
+        P3_frameTable[i].sharers=NULL;
+        freeList[numFree++]=i;
     }
-    P3_vmStats.freeFrames = frames;
+    result = P1_SemCreate("frameMutex",1,&frameMutex);
+    P3_vmStats.freeFrames = numFree;
     frameInitialized = TRUE;
     return result;
 }
@@ -123,7 +205,11 @@ P3FrameShutdown(void)
         return P3_NOT_INITIALIZED;
     }
     // clean things up
-    free(framesTable);
+    free(P3_frameTable);
+    P3_frameTable = NULL;
+    free(freeList);
+    free(zeroList);
+    result = P1_SemFree(frameMutex);
     frameInitialized = FALSE;
     return result;
 }
@@ -152,17 +238,170 @@ P3FrameFreeAll(int pid)
     if(frameInitialized==FALSE){
         return P3_NOT_INITIALIZED;
     }
+    // wait for any reads the pagers have in flight for the process
+    if(pagerInitialized==TRUE&&pid>=0&&pid<P1_MAXPROC){
+        int rc = P1_P(pagerMutex);
+        faults[pid].exiting = TRUE;
+        for(int i=0;i<MAX_INFLIGHT;i++){
+            if(inflight[i].pid==pid){
+                inflightWaiters++;
+                rc = P1_V(pagerMutex);
+                rc = P1_P(inflightDone);
+                rc = P1_P(pagerMutex);
+                i = -1;
+            }
+        }
+        readahead[pid].lastPage = -1;
+        readahead[pid].size = 0;
+        rc = P1_V(pagerMutex);
+    }
     // free all frames in use by the process (P3PageTableGet)
     USLOSS_PTE  *table = NULL;
     result = P3PageTableGet(pid,&table);
-    if(result==P1_SUCCESS){
+    if(result==P1_SUCCESS&&table!=NULL){
         for(int i=0;i<numPages;i++){
-            framesTable[table[i].frame].used=FALSE;
+            if((table+i)->incore==1){
+                // a copy-on-write frame stays until its last sharer is done
+                if(P3SwapDropFrame(pid, i)==TRUE){
+                    FrameFree((table+i)->frame);
+                }
+                (table+i)->incore=0;
+            }
         }
+        // a pager may be waiting for a frame
+        int rc;
+        rc = P3SwapWake();
     }
     return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameAlloc --
+ *
+ *  Takes a free frame. If wantZero is TRUE a zeroed frame is preferred,
+ *  otherwise one that isn't zeroed is, so that page-ins don't use up the
+ *  zeroed frames. *zeroed is set to whether the frame is zeroed.
+ *
+ * Results:
+ *   The frame number, or -1 if there are no free frames.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FrameAlloc(int wantZero, int *zeroed)
+{
+    int frame = -1;
+    int rc = P1_P(frameMutex);
+    *zeroed = FALSE;
+    if(numZeroed>0&&(wantZero==TRUE||numFree==0)){
+        frame=zeroList[--numZeroed];
+        *zeroed = TRUE;
+    }else if(numFree>0){
+        frame=freeList[--numFree];
+    }
+    if(frame!=-1){
+        P3_frameTable[frame].used=TRUE;
+        P3_vmStats.freeFrames = numFree+numZeroed+numZeroing;
+        if(zeroIdle==TRUE&&numZeroed<P3_ZERO_RESERVE&&numFree>0){
+            zeroIdle = FALSE;
+            rc = P1_V(zeroWork);
+        }
+    }
+    rc = P1_V(frameMutex);
+    return frame;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameFree --
+ *
+ *  Puts a frame back on the free list. Frames that are already free
+ *  are ignored so that a frame can't end up on the list twice.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+FrameFree(int frame)
+{
+    if(frame<0||frame>=numFrames){
+        return;
+    }
+    int rc = P1_P(frameMutex);
+    if(P3_frameTable[frame].used==TRUE){
+        P3_frameTable[frame].used=FALSE;
+        freeList[numFree++]=frame;
+        P3_vmStats.freeFrames = numFree+numZeroed+numZeroing;
+        if(zeroIdle==TRUE&&numZeroed<P3_ZERO_RESERVE){
+            zeroIdle = FALSE;
+            rc = P1_V(zeroWork);
+        }
+    }
+    rc = P1_V(frameMutex);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Zeroer --
+ *
+ *  Zeroing daemon. Runs at the lowest priority and moves frames from
+ *  freeList to zeroList, zeroing them on the way, until there are
+ *  P3_ZERO_RESERVE zeroed frames or no more frames to zero. Finishes
+ *  the frame it is zeroing before it quits, so that P3PagerShutdown can
+ *  wait for it before the frame lists are freed.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Zeroer(void *arg)
+{
+    int result = P1_SUCCESS;
+    USLOSS_PTE *table = NULL;
+
+    // we need a page table of our own to map frames into
+    result = P3PageTableGet(P1_GetPid(),&table);
+    if(table==NULL){
+        table = P3PageTableAllocateEmpty(numPages);
+        result = P3PageTableSet(P1_GetPid(),table);
+    }
+    result = P1_V(pagerRunning);
+    while(1){
+        result = P1_P(frameMutex);
+        if(pagerShutdown==FALSE&&(numZeroed>=P3_ZERO_RESERVE||numFree==0)){
+            zeroIdle = TRUE;
+            result = P1_V(frameMutex);
+            result = P1_P(zeroWork);
+            result = P1_P(frameMutex);
+        }
+        if(pagerShutdown==TRUE){
+            result = P1_V(frameMutex);
+            break;
+        }
+        int frame = -1;
+        if(numZeroed<P3_ZERO_RESERVE&&numFree>0){
+            frame=freeList[--numFree];
+            numZeroing++;
+        }
+        result = P1_V(frameMutex);
+        if(frame==-1){
+            continue;
+        }
+        void *addr;
+        result = P3FrameMap(frame, &addr);
+        memset(addr, 0, USLOSS_MmuPageSize());
+        result = P3FrameUnmap(frame);
+        result = P1_P(frameMutex);
+        numZeroing--;
+        zeroList[numZeroed++]=frame;
+        result = P1_V(frameMutex);
+    }
+    result = P1_V(zeroDone);
+    return result;
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -180,6 +419,35 @@ P3FrameFreeAll(int pid)
  */
 int
 P3FrameMap(int frame, void **addr) 
+{
+    if ((USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE) == 0){
+        USLOSS_IllegalInstruction();
+    }
+    if(frameInitialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    return P3FrameMapRun(1, &frame, addr);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameMapRun --
+ *
+ *  Like P3FrameMap, but maps count frames to consecutive unused pages
+ *  so that they can be read or written with a single disk operation.
+ *  Each frame is unmapped with P3FrameUnmap.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P3_OUT_OF_PAGES:       process has no run of count free pages
+ *   P1_INVALID_FRAME       a frame number is invalid
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameMapRun(int count, int *frames, void **addr)
 {
     if ((USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE) == 0){
         USLOSS_IllegalInstruction();
@@ -188,34 +456,38 @@ P3FrameMap(int frame, void **addr)
     if(frameInitialized==FALSE){
         return P3_NOT_INITIALIZED;
     }
+    for(int i=0;i<count;i++){
+        if(frames[i]<0||frames[i]>=numFrames){
+            return P3_INVALID_FRAME;
+        }
+    }
     // get the page table for the process (P3PageTableGet)
-    // find an unused page
-    // update the page's PTE to map the page to the frame
+    // find a run of unused pages
+    // update the pages' PTEs to map them to the frames
     // update the page table in the MMU (USLOSS_MmuSetPageTable)
-    
-    int pid = faultQueue[qFront].pid;
+    int pid = P1_GetPid();
     USLOSS_PTE  *table = NULL;
     result = P3PageTableGet(pid,&table);
-    
+
     int page;
-    for(page=0;page<numPages;page++){
-        if((table+page)->incore==0){
-            break;
-        }
+    int run = 0;
+    for(page=0;page<numPages&&run<count;page++){
+        run = ((table+page)->incore==0) ? run+1 : 0;
     }
-    if(page<0||page>=numPages){
+    if(run<count){
         return P3_OUT_OF_PAGES;
     }
-    if(frame<0||frame>=numFrames){
-        return P3_INVALID_FRAME;
-    }
+    page -= count;
     int size;
     void *vmRegion = USLOSS_MmuRegion(&size);
     *addr = (void*) (vmRegion+page*USLOSS_MmuPageSize());
-    (table+page)->incore=1;
-    (table+page)->write=1;
-    (table+page)->read=1;
-    (table+page)->frame=frame;
+    for(int i=0;i<count;i++){
+        (table+page+i)->incore=1;
+        (table+page+i)->write=1;
+        (table+page+i)->read=1;
+        (table+page+i)->frame=frames[i];
+        P3_frameTable[frames[i]].mapPage=page+i;
+    }
     //printf("map pid:%d page:%d frame:%d\n", pid,page,frame);
     result = USLOSS_MmuSetPageTable(table);
     return result;
@@ -250,26 +522,77 @@ P3FrameUnmap(int frame)
     // update page's PTE to remove the mapping
     // update the page table in the MMU (USLOSS_MmuSetPageTable)
     
-    int pid = faultQueue[qFront].pid;
+    if(frame<0||frame>=numFrames){
+        return P3_INVALID_FRAME;
+    }
+    int pid = P1_GetPid();
     USLOSS_PTE  *table = NULL;
     result = P3PageTableGet(pid,&table);
-    int page;
-    for(page=0;page<numPages;page++){
-        if((table+page)->frame==frame){
-            break;
-        }
-    }
-    if(page<0||page>=numPages){
+    // use the page P3FrameMap chose
+    int page = P3_frameTable[frame].mapPage;
+    if(page<0||page>=numPages||(table+page)->incore==0||(table+page)->frame!=frame){
         return P3_FRAME_NOT_MAPPED;
     }
-    if(frame<0||frame>=numFrames){
-        return P3_INVALID_FRAME;
-    }
     //printf("unmap pid:%d page:%d frame:%d\n", pid,page,frame);
+    P3_frameTable[frame].mapPage=-1;
+    (table+page)->incore=0;
     result = USLOSS_MmuSetPageTable(table);
     return result;
 }
 
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameRelease --
+ *
+ *  Puts a frame that phase 3d no longer needs, such as one whose page
+ *  was merged onto an identical page, back on the free list.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P3_INVALID_FRAME:      the frame number is invalid
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameRelease(int frame)
+{
+    if(frameInitialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(frame<0||frame>=numFrames){
+        return P3_INVALID_FRAME;
+    }
+    FrameFree(frame);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3FrameTake --
+ *
+ *  Takes a free frame for phase 3d. A pager that found nothing to
+ *  replace checks here before it waits, since frames can be freed
+ *  while it looks.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3FrameInit has not been called
+ *   P1_SUCCESS:            success, *frame is -1 if no frame is free
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3FrameTake(int *frame)
+{
+    int zeroed;
+    if(frameInitialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    *frame = FrameAlloc(FALSE, &zeroed);
+    return P1_SUCCESS;
+}
 
 /*
  *----------------------------------------------------------------------
@@ -284,31 +607,33 @@ P3FrameUnmap(int frame)
 static void
 FaultHandler(int type, void *arg)
 {
-    Fault   fault;
     int result;
-    fault.offset = (int) arg;
+    // the process may have been suspended to stop the system from thrashing
+    result = P3SwapAdmit(P1_GetPid());
+    Fault   *fault = &faults[P1_GetPid()];
+    fault->offset = (int) arg;
     // fill in other fields in fault
-    fault.pid=P1_GetPid();
-    fault.rc=0;
-    //printf("fault %d\n", fault.pid);
-    fault.cause=USLOSS_MmuGetCause();
-    char name[P1_MAXNAME+1];
-    snprintf(name, sizeof(name), "Fault %d", fault.pid);
-    result = P1_SemCreate(name,0,&fault.wait);
+    fault->rc=0;
+    //printf("fault %d\n", fault->pid);
+    fault->cause=USLOSS_MmuGetCause();
     // add to queue of pending faults
-    faultQueue[qRear]=fault;
+    result = P1_P(pagerMutex);
+    fault->exiting=FALSE;
+    pending[qRear]=fault->pid;
     qRear=(qRear+1)%P1_MAXPROC;
+    result = P1_V(pagerMutex);
     // let pagers know there is a pending fault
     result = P1_V(faultMutex);
     // wait for fault to be handled
-    result = P1_P(fault.wait);
-    result = P1_SemFree(fault.wait);
-    if(faultQueue[qFront].rc==USLOSS_MMU_ACCESS){
+    result = P1_P(fault->wait);
+    if(fault->rc==USLOSS_MMU_ACCESS){
         P2_Terminate(USLOSS_MMU_ACCESS);
-    }else if(faultQueue[qFront].rc==P3_OUT_OF_SWAP){
+    }else if(fault->rc==P3_OUT_OF_SWAP){
         P2_Terminate(P3_OUT_OF_SWAP);
+    }else if(fault->rc!=P1_SUCCESS){
+        // the pager couldn't get the page a frame
+        P2_Terminate(fault->rc);
     }
-    qFront=(qFront+1)%P1_MAXPROC;
 }
 
 
@@ -347,6 +672,25 @@ P3PagerInit(int pages, int frames, int pagers)
     result = P1_SemCreate("faultMutex",0,&faultMutex);
     result = P1_SemCreate("pagerMutex",1,&pagerMutex);
     result = P1_SemCreate("pagerRunning",0,&pagerRunning);
+    for(int i=0;i<P1_MAXPROC;i++){
+        char name[P1_MAXNAME+1];
+        snprintf(name, sizeof(name), "Fault %d", i);
+        faults[i].pid=i;
+        faults[i].next=NULL;
+        faults[i].exiting=FALSE;
+        result = P1_SemCreate(name,0,&faults[i].wait);
+        readahead[i].lastPage=-1;
+        readahead[i].window=2;
+        readahead[i].start=0;
+        readahead[i].size=0;
+        readahead[i].mask=0;
+    }
+    result = P1_SemCreate("inflightDone",0,&inflightDone);
+    for(int i=0;i<MAX_INFLIGHT;i++){
+        inflight[i].pid=-1;
+        inflight[i].page=-1;
+        inflight[i].waiters=NULL;
+    }
     numPagers = pagers;
     for(int i=0;i<pagers;i++){
         char name[P1_MAXNAME+1];
@@ -354,6 +698,10 @@ P3PagerInit(int pages, int frames, int pagers)
         result = P1_Fork(name,Pager,NULL,USLOSS_MIN_STACK * 4,P3_PAGER_PRIORITY,0,&pagerPID[i]);
         result = P1_P(pagerRunning);
     }
+    result = P1_SemCreate("zeroWork",0,&zeroWork);
+    result = P1_SemCreate("zeroDone",0,&zeroDone);
+    result = P1_Fork("Zeroer",Zeroer,NULL,USLOSS_MIN_STACK * 4,P3_ZERO_PRIORITY,0,&zeroPID);
+    result = P1_P(pagerRunning);
     pagerInitialized=TRUE;
     return result;
 }
@@ -387,11 +735,20 @@ P3PagerShutdown(void)
     for(int i=0;i<numPagers;i++){
         result = P1_V(faultMutex);
     }
+    result = P1_V(zeroWork);
+    // wait for the zeroing daemon, it may be in the middle of a frame
+    result = P1_P(zeroDone);
     // clean up the pager data structures
     free(pagerPID);
     result = P1_SemFree(faultMutex);
     result = P1_SemFree(pagerMutex);
     result = P1_SemFree(pagerRunning);
+    result = P1_SemFree(zeroWork);
+    result = P1_SemFree(zeroDone);
+    result = P1_SemFree(inflightDone);
+    for(int i=0;i<P1_MAXPROC;i++){
+        result = P1_SemFree(faults[i].wait);
+    }
     return result;
 }
 
@@ -413,7 +770,8 @@ Pager(void *arg)
     notify P3PagerInit that we are running
     loop until P3PagerShutdown is called
         wait for a fault
-        if it's an access fault kill the faulting process
+        if it's an access fault give the process its own copy of a
+            copy-on-write page, or kill it if the page isn't copy-on-write
         if there are free frames
             frame = a free frame
         else
@@ -423,53 +781,429 @@ Pager(void *arg)
             P3FrameMap(frame, &addr)
             zero-out frame at addr
             P3FrameUnmap(frame);
+            clear the frame's dirty bit
         else if rc == P3_OUT_OF_SWAP
             kill the faulting process
         update PTE in faulting process's page table to map page to frame
         unblock faulting process
 
     **********************************/
-    int result = P1_V(pagerRunning);
+    int result = P1_SUCCESS;
+    USLOSS_PTE *own = NULL;
+
+    // Frames are mapped into a page table of our own while we fill them.
+    // The faulting process is running again by the time we read ahead,
+    // so its page table can't be used.
+    result = P3PageTableGet(P1_GetPid(),&own);
+    if(own==NULL){
+        own = P3PageTableAllocateEmpty(numPages);
+        result = P3PageTableSet(P1_GetPid(),own);
+    }
+    result = P1_V(pagerRunning);
     while(1){
         result = P1_P(faultMutex);
         if(pagerShutdown==TRUE){
             break;
         }
+        // pagerMutex only protects the queue and the in-flight pages, the
+        // fault itself is handled without it so that the pagers can do
+        // their I/O concurrently
         result = P1_P(pagerMutex);
-        Fault fault = faultQueue[qFront];
-        if(fault.cause==USLOSS_MMU_ACCESS){
-            faultQueue[qFront].rc = USLOSS_MMU_ACCESS;
-            result = P1_V(fault.wait);
+        Fault *fault = &faults[pending[qFront]];
+        qFront=(qFront+1)%P1_MAXPROC;
+        fault->next = NULL;
+        int page = fault->offset/USLOSS_MmuPageSize();
+        if(fault->cause==USLOSS_MMU_ACCESS){
+            result = P1_V(pagerMutex);
+            fault->rc = CowFault(fault, page);
+            result = P1_V(fault->wait);
+            continue;
+        }
+        Inflight *op = InflightFind(fault->pid, page);
+        if(op!=NULL){
+            // someone is already bringing the page in, wait for them
+            fault->next = op->waiters;
+            op->waiters = fault;
             result = P1_V(pagerMutex);
             continue;
         }
-        int frame;
-        for(frame=0;frame<numFrames;frame++){
-            if(framesTable[frame].used==FALSE){
-                break;
+        USLOSS_PTE *table = NULL;
+        result = P3PageTableGet(fault->pid,&table);
+        if((table+page)->incore==1){
+            // the page arrived after the fault was raised
+            result = P1_V(pagerMutex);
+            fault->rc = P1_SUCCESS;
+            result = P1_V(fault->wait);
+            continue;
+        }
+        op = InflightStart(fault->pid, page);
+        op->waiters = fault;
+        int ahead = ReadaheadCheck(fault->pid, page);
+        result = P1_V(pagerMutex);
+
+        // first-touch pages take a frame the zeroing daemon already cleared
+        int zeroed = FALSE;
+        int frame = -1;
+        int rc = P1_SUCCESS;
+        if(P3SwapAtLimit(fault->pid)==TRUE){
+            // local replacement, the process gives up one of its own pages
+            rc = P3SwapOutLocal(fault->pid, &frame);
+        }else{
+            frame = FrameAlloc(!P3SwapHasPage(fault->pid, page), &zeroed);
+            if(frame==-1){
+                rc = P3SwapOut(&frame);
             }
         }
-        if(frame==numFrames){
-            result = P3SwapOut(&frame);
+        if(frame==-1){
+            // no frame is never a success, the process would just fault again
+            if(rc==P1_SUCCESS){
+                rc = P3_OUT_OF_SWAP;
+            }
+            result = P1_P(pagerMutex);
+            InflightComplete(op, rc);
+            result = P1_V(pagerMutex);
+            continue;
         }
-        int page = fault.offset/USLOSS_MmuPageSize();
-        result = P3SwapIn(fault.pid, page, frame);
+        result = P3SwapIn(fault->pid, page, frame);
         if (result == P3_EMPTY_PAGE){
-            void *addr;
-            result = P3FrameMap(frame, &addr);
-            memset(addr, 0, USLOSS_MmuPageSize());
-            result = P3FrameUnmap(frame);
-        }else if (result == P3_OUT_OF_SWAP){
-            faultQueue[qFront].rc = P3_OUT_OF_SWAP;
-            result = P1_V(fault.wait);
+            if (zeroed == FALSE){
+                void *addr;
+                result = P3FrameMap(frame, &addr);
+                memset(addr, 0, USLOSS_MmuPageSize());
+                result = P3FrameUnmap(frame);
+            }
+            // a page that is never written is zero-filled again after it
+            // is evicted, so it doesn't need to be written out
+            result = USLOSS_MmuSetAccess(frame, 0);
+        }else if (result != P1_SUCCESS){
+            // out of swap, or the page couldn't be loaded into the frame
+            FrameFree(frame);
+            rc = result;
+            result = P1_P(pagerMutex);
+            InflightComplete(op, rc);
             result = P1_V(pagerMutex);
+            result = P3SwapWake();
             continue;
         }
-        // USLOSS_PTE *table = NULL;
-        // result = P3PageTableGet(fault.pid,&table);
-        framesTable[frame].used=TRUE;
-        result = P1_V(fault.wait);
+        // a page shared copy-on-write is mapped read-only
+        int cow = P3SwapCowCheck(fault->pid, page);
+        // update PTE in faulting process's page table to map page to frame
+        result = P1_P(pagerMutex);
+        (table+page)->read=1;
+        (table+page)->write=(cow==P3_COW_SHARED) ? 0 : 1;
+        (table+page)->frame=frame;
+        (table+page)->incore=1;
+        result = USLOSS_MmuSetPageTable(table);
+        InflightComplete(op, P1_SUCCESS);
         result = P1_V(pagerMutex);
+        // the frame can be replaced now, wake anyone waiting for a victim
+        result = P3SwapWake();
+        // the faulting process is running again, now read ahead
+        if(ahead>0){
+            ReadaheadFill(fault, page, ahead);
+        }
     }
     return result;
 }
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CowFault --
+ *
+ *  Handles an access fault. A write to a copy-on-write page gets the
+ *  process its own copy of the page, any other access fault is an error.
+ *
+ * Results:
+ *   P1_SUCCESS:            the process can retry the access
+ *   USLOSS_MMU_ACCESS:     the access was illegal
+ *   P3_OUT_OF_SWAP:        there is no swap space or no frame for the copy
+ *   P3_OUT_OF_PAGES:       the page couldn't be copied
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+CowFault(Fault *fault, int page)
+{
+    int result;
+    int cow = P3SwapCowCheck(fault->pid, page);
+    if(cow==P3_COW_NONE){
+        return USLOSS_MMU_ACCESS;
+    }
+    USLOSS_PTE *table = NULL;
+    result = P3PageTableGet(fault->pid,&table);
+    if(cow==P3_COW_SHARED){
+        int zeroed = FALSE;
+        int frame = -1;
+        result = P1_SUCCESS;
+        if(P3SwapAtLimit(fault->pid)==TRUE){
+            result = P3SwapOutLocal(fault->pid, &frame);
+        }else{
+            frame = FrameAlloc(FALSE, &zeroed);
+            if(frame==-1){
+                result = P3SwapOut(&frame);
+            }
+        }
+        if(frame==-1){
+            return (result==P1_SUCCESS) ? P3_OUT_OF_SWAP : result;
+        }
+        result = P3SwapCowCopy(fault->pid, page, frame);
+        if(result==P1_SUCCESS){
+            result = P1_P(pagerMutex);
+            (table+page)->frame=frame;
+            (table+page)->write=1;
+            result = USLOSS_MmuSetPageTable(table);
+            result = P1_V(pagerMutex);
+            result = P3SwapWake();
+            return P1_SUCCESS;
+        }
+        FrameFree(frame);
+        int rc;
+        rc = P3SwapWake();
+        if(result==P3_OUT_OF_SWAP||result==P3_OUT_OF_PAGES){
+            return result;
+        }
+        if(result!=P3_COW_PRIVATE){
+            // the page was replaced in the meantime, the retry faults it in
+            return P1_SUCCESS;
+        }
+    }
+    // nobody else has the page any more, it can just be written
+    result = P1_P(pagerMutex);
+    if((table+page)->incore==1){
+        (table+page)->write=1;
+        result = USLOSS_MmuSetPageTable(table);
+    }
+    result = P1_V(pagerMutex);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReadaheadCheck --
+ *
+ *  Scores the process's last readahead window, adjusts the window size,
+ *  and decides whether the fault on page is sequential.
+ *  Call with pagerMutex held.
+ *
+ * Results:
+ *   The number of pages to read ahead after page, 0 if none.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+ReadaheadCheck(PID pid, int page)
+{
+    Readahead *ra = &readahead[pid];
+    int sequential = (page==ra->lastPage+1);
+    if(ra->size>0){
+        USLOSS_PTE *table = NULL;
+        int rc = P3PageTableGet(pid,&table);
+        int hits = 0;
+        int misses = 0;
+        for(int i=0;i<ra->size;i++){
+            if((ra->mask&(1<<i))==0){
+                continue;
+            }
+            USLOSS_PTE *pte = table+ra->start+i;
+            int access = 0;
+            if(pte->incore==1){
+                rc = USLOSS_MmuGetAccess(pte->frame,&access);
+            }
+            if(ra->start+i!=page&&(access&USLOSS_MMU_REF)!=0){
+                hits++;
+            }else{
+                misses++;
+            }
+        }
+        P3_vmStats.prefetchHits += hits;
+        P3_vmStats.prefetchMisses += misses;
+        if(misses==0&&hits>0){
+            ra->window = ra->window*2;
+            if(ra->window>P3_READAHEAD_MAX){
+                ra->window=P3_READAHEAD_MAX;
+            }
+        }else if(hits<misses){
+            ra->window = ra->window/2;
+            if(ra->window<1){
+                ra->window=1;
+            }
+        }
+        if(page==ra->start+ra->size){
+            sequential = TRUE;
+        }
+        ra->size = 0;
+        ra->mask = 0;
+    }
+    ra->lastPage = page;
+    return sequential ? ra->window : 0;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ReadaheadFill --
+ *
+ *  Reads up to count pages following page into free frames. Only pages
+ *  that are on swap are read, and only into frames that are free; we
+ *  never evict a page to make room for a guess. Each page is registered
+ *  as in flight so that a fault on it waits for the read instead of
+ *  starting another.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ReadaheadFill(Fault *fault, int page, int count)
+{
+    int result;
+    PID pid = fault->pid;
+    USLOSS_PTE *table = NULL;
+    Readahead *ra = &readahead[pid];
+
+    result = P3PageTableGet(pid,&table);
+    for(int i=1;i<=count&&page+i<numPages;i++){
+        int next = page+i;
+        result = P1_P(pagerMutex);
+        if(fault->exiting==TRUE){
+            result = P1_V(pagerMutex);
+            break;
+        }
+        if((table+next)->incore==1||InflightFind(pid,next)!=NULL){
+            result = P1_V(pagerMutex);
+            continue;
+        }
+        Inflight *op = InflightStart(pid, next);
+        result = P1_V(pagerMutex);
+
+        int zeroed = FALSE;
+        int frame = -1;
+        // a process at its limit doesn't get extra frames to read ahead into
+        if(P3SwapHasPage(pid, next)==TRUE&&P3SwapAtLimit(pid)==FALSE){
+            frame = FrameAlloc(FALSE, &zeroed);
+        }
+        if(frame!=-1){
+            // the process didn't fault on the page, don't count it as a fault
+            result = P3SwapInAhead(pid, next, frame);
+            if(result == P3_EMPTY_PAGE){
+                if(zeroed == FALSE){
+                    void *addr;
+                    result = P3FrameMap(frame, &addr);
+                    memset(addr, 0, USLOSS_MmuPageSize());
+                    result = P3FrameUnmap(frame);
+                }
+                result = USLOSS_MmuSetAccess(frame, 0);
+            }else if(result != P1_SUCCESS){
+                FrameFree(frame);
+                frame = -1;
+            }
+        }
+        int cow = (frame!=-1) ? P3SwapCowCheck(pid, next) : P3_COW_NONE;
+        result = P1_P(pagerMutex);
+        if(frame!=-1){
+            int access;
+            // clear the reference bit so that we can tell if the page is used
+            result = USLOSS_MmuGetAccess(frame,&access);
+            result = USLOSS_MmuSetAccess(frame,access&USLOSS_MMU_DIRTY);
+            (table+next)->read=1;
+            (table+next)->write=(cow==P3_COW_SHARED) ? 0 : 1;
+            (table+next)->frame=frame;
+            (table+next)->incore=1;
+            if(ra->size==0){
+                ra->start=page+1;
+            }
+            ra->size=i;
+            ra->mask|=1<<(i-1);
+            P3_vmStats.prefetched++;
+        }
+        InflightComplete(op, P1_SUCCESS);
+        result = P1_V(pagerMutex);
+        if(frame==-1){
+            // no free frames, or the rest of the window isn't on swap
+            break;
+        }
+    }
+    // the frames we filled can be replaced now, and any we gave back are free
+    result = P3SwapWake();
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InflightFind --
+ *
+ *  Looks for an operation that is bringing in the given page.
+ *  Call with pagerMutex held.
+ *
+ * Results:
+ *   The operation, or NULL if the page isn't in flight.
+ *
+ *----------------------------------------------------------------------
+ */
+static Inflight *
+InflightFind(PID pid, int page)
+{
+    for(int i=0;i<MAX_INFLIGHT;i++){
+        if(inflight[i].pid==pid&&inflight[i].page==page){
+            return &inflight[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InflightStart --
+ *
+ *  Records that a page is being brought in. There is always a free
+ *  entry since every entry either has a waiting process or is a
+ *  pager's readahead read. Call with pagerMutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static Inflight *
+InflightStart(PID pid, int page)
+{
+    Inflight *op = NULL;
+    for(int i=0;op==NULL&&i<MAX_INFLIGHT;i++){
+        if(inflight[i].pid==-1){
+            op=&inflight[i];
+        }
+    }
+    assert(op!=NULL);
+    op->pid=pid;
+    op->page=page;
+    op->waiters=NULL;
+    return op;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * InflightComplete --
+ *
+ *  Wakes every fault waiting on the operation with the given result
+ *  and frees the entry. Call with pagerMutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+InflightComplete(Inflight *op, int rc)
+{
+    int result;
+    Fault *next;
+    for(Fault *fault=op->waiters;fault!=NULL;fault=next){
+        next=fault->next;
+        fault->next=NULL;
+        fault->rc=rc;
+        result = P1_V(fault->wait);
+    }
+    op->pid=-1;
+    op->page=-1;
+    op->waiters=NULL;
+    while(inflightWaiters>0){
+        inflightWaiters--;
+        result = P1_V(inflightDone);
+    }
+}
@@ -148,5 +148,16 @@ void test_cleanup(int argc, char **argv) {
 int P3SwapInit(int pages, int frames) {return P1_SUCCESS;}
 int P3SwapShutdown(void) {return P1_SUCCESS;}
 int P3SwapFreeAll(PID pid) {return P1_SUCCESS;}
+int P3SwapHasPage(PID pid, int page) {return FALSE;}
+int P3SwapAdmit(PID pid) {return P1_SUCCESS;}
+int P3SwapSetLimit(PID pid, int frames) {return P1_SUCCESS;}
+int P3SwapAtLimit(PID pid) {return FALSE;}
+int P3SwapOutLocal(PID pid, int *frame) {return P1_SUCCESS;}
+int P3SwapDropFrame(PID pid, int page) {return TRUE;}
+int P3SwapClone(PID parent, PID child) {return P1_SUCCESS;}
+int P3SwapCowCheck(PID pid, int page) {return P3_COW_NONE;}
+int P3SwapCowCopy(PID pid, int page, int frame) {return P3_COW_PRIVATE;}
+int P3SwapWake(void) {return P1_SUCCESS;}
 int P3SwapOut(int *frame) {return P1_SUCCESS;}
 int P3SwapIn(PID pid, int page, int frame) {return P3_EMPTY_PAGE;}
+int P3SwapInAhead(PID pid, int page, int frame) {return P3_EMPTY_PAGE;}
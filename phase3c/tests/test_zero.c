@@ -0,0 +1,157 @@
+/*
+ * test_zero.c
+ *
+ *  Tests the zeroing daemon. There are as many frames as pages. Child "A" fills every
+ *  page with its name and quits, which frees all of the frames with A's data still in
+ *  them. P4_Startup sleeps so that the zeroing daemon, which runs at the lowest priority,
+ *  can zero some of them, then checks that every frame is counted as free. Child "B"
+ *  then reads its pages for the first time; they get the frames the daemon zeroed, or
+ *  are zeroed by the pager, and either way must be full of zeros.
+ *
+ *  The test does this twice. The second time the VM system is shut down right after A
+ *  quits, while the daemon may still be zeroing, and must still shut down cleanly.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 6         // # of pages
+#define FRAMES PAGES    // # of frames
+#define PAGERS 2        // # of pagers
+#define ROUNDS 2
+
+static char *vmRegion;
+static int  pageSize;
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static int
+Writer(void *arg)
+{
+    char    *page;
+
+    Debug("Writer starting.\n");
+    for (int j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Writer writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A';
+        }
+    }
+    Debug("Writer done.\n");
+    return 0;
+}
+
+static int
+Reader(void *arg)
+{
+    char    *page;
+
+    Debug("Reader starting.\n");
+    for (int j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Reader reading zeros from page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], '\0');
+        }
+    }
+    Debug("Reader done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    for (i = 0; i < ROUNDS; i++) {
+        rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+        TEST(rc, P1_SUCCESS);
+        pageSize = USLOSS_MmuPageSize();
+
+        rc = Sys_Spawn("A", Writer, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+        if (i == ROUNDS - 1) {
+            // shut down while the daemon may still be busy
+            Sys_VmShutdown();
+            break;
+        }
+        // let the daemon zero the frames A left behind
+        rc = Sys_Sleep(1);
+        assert(rc == P1_SUCCESS);
+        TEST(P3_vmStats.freeFrames, FRAMES);
+
+        rc = Sys_Spawn("B", Reader, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+        Sys_VmShutdown();
+    }
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
+
+// Phase 3d stubs
+
+#include "phase3Int.h"
+
+int P3SwapInit(int pages, int frames) {return P1_SUCCESS;}
+int P3SwapShutdown(void) {return P1_SUCCESS;}
+int P3SwapFreeAll(PID pid) {return P1_SUCCESS;}
+int P3SwapHasPage(PID pid, int page) {return FALSE;}
+int P3SwapAdmit(PID pid) {return P1_SUCCESS;}
+int P3SwapSetLimit(PID pid, int frames) {return P1_SUCCESS;}
+int P3SwapAtLimit(PID pid) {return FALSE;}
+int P3SwapOutLocal(PID pid, int *frame) {return P1_SUCCESS;}
+int P3SwapDropFrame(PID pid, int page) {return TRUE;}
+int P3SwapClone(PID parent, PID child) {return P1_SUCCESS;}
+int P3SwapCowCheck(PID pid, int page) {return P3_COW_NONE;}
+int P3SwapCowCopy(PID pid, int page, int frame) {return P3_COW_PRIVATE;}
+int P3SwapWake(void) {return P1_SUCCESS;}
+int P3SwapOut(int *frame) {return P1_SUCCESS;}
+int P3SwapIn(PID pid, int page, int frame) {return P3_EMPTY_PAGE;}
+int P3SwapInAhead(PID pid, int page, int frame) {return P3_EMPTY_PAGE;}
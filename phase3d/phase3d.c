@@ -22,9 +22,12 @@ A process's page table is a shared resource with the pager. The process changes
 when it quits, and a pager changes the page table when it selects one of the process's pages
 in the clock algorithm. 
 
-Normally the pagers would perform I/O concurrently, which means they would release the mutex
-while performing disk I/O. I made it simpler by having the pagers hold the mutex while they perform
-disk I/O.
+The pagers perform I/O concurrently, so they release the mutex while performing disk I/O.
+Before dropping the mutex a pager marks both the frame and the page it is moving as busy. Busy
+frames are skipped by the clock, and anyone that needs a busy page (a pager swapping it back in,
+or P3SwapFreeAll when its owner quits) waits in WaitIO until the I/O completes. The victim's PTE
+is cleared before its page is written, so the process can't change the page while it is in
+transit; if it touches the page it faults and waits for the write to finish.
 
 ***************/
 
@@ -60,138 +63,3447 @@ static int initialized=FALSE;
 static int numFrames;
 static int numPages;
 static int mutex;
-typedef struct Frame
+// The frame descriptors are P3_frameTable, shared with phase 3c. A
+// copy-on-write frame is mapped by several processes; the descriptor has
+// the first of them, the rest are on the frame's list of sharers.
+
+// Pagers waiting for some other pager's I/O to complete. Every completion
+// wakes all of them and they recheck whatever they were waiting for.
+static int ioDone;
+static int ioWaiters;
+
+static void WaitIO(void);
+static void CompleteIO(void);
+
+static int  FrameEvictable(int frame);
+static int  FrameDrop(PID pid, int page);
+static int  FrameVictim(int frame);
+static int  SwapOut(PID local, int *frame);
+#define SWAP_SUSPENDED -2   // SwapOut only replaces a suspended process's page
+static int  PageWrite(int *frames, PID pid, int page, int count);
+static int  ClusterFrame(PID pid, int page, int q);
+static int  ClusterWrite(int target, PID pid, int page);
+static void WriteDone(int frame);
+static void SwapOutUndo(int target, PID pid, int page);
+static int  FrameCopy(int from, int to);
+static int  SwapIn(PID pid, int page, int frame, int prefetch);
+
+// Write-behind cleaner, see Cleaner.
+static int cleanerPID;
+static int cleanerWork;         // the cleaner waits here when it has nothing to do
+static int cleanerDone;         // the cleaner V's this when it quits
+static int cleanerIdle = FALSE;
+static int cleanerShutdown = FALSE;
+static int cleanLow;            // watermarks, in frames
+static int cleanHigh;
+static int Cleaner(void *arg);
+static void CleanerKick(void);
+
+// Same-page merger, see Merger. scan[frame] remembers what the frame held
+// at the last pass; scanHead and scan[].next chain this pass's stable
+// frames into buckets by hash.
+typedef struct Scan{
+    PID pid;        // -1 if the frame wasn't hashed
+    int page;
+    unsigned int hash;
+    int next;
+}Scan;
+
+static Scan *scan;
+static int *scanHead;
+static int mergerPID;
+static int mergerWork;
+static int mergerDone;
+static int mergerIdle = FALSE;
+static int mergerShutdown = FALSE;
+static int mergeTime;           // faultTime of the last pass
+static int Merger(void *arg);
+static void MergerKick(void);
+static int  MergePages(int keep, int drop);
+static unsigned int PageHash(unsigned char *addr, int len);
+static void AccessRestore(int frame, int access);
+
+// Resumes suspended processes when nothing else can run, see Resumer.
+static int resumerPID;
+static int resumerWork;
+static int resumerDone;
+static int resumerIdle = FALSE;
+static int resumerShutdown = FALSE;
+static int Resumer(void *arg);
+static void ResumerKick(void);
+
+static int sectorSize;      // the same on every swap unit
+static int trackSize;
+
+// Swap is striped across disk units. Each unit's slots are numbered after
+// the previous unit's, and new extents go to the unit with the fewest
+// reads and writes in progress so that pagers paging in and out at the
+// same time use different disks.
+typedef struct Unit{
+    int disk;       // USLOSS disk unit
+    int base;       // first slot on the unit
+    int slots;      // # slots on the unit
+    int start;      // next extent to look at when allocating
+    int next;       // next-fit: where the last single-slot search stopped
+    int free;       // # free slots
+    int queue;      // # reads and writes in progress
+}Unit;
+
+static int swapDisks[] = P3_SWAP_DISKS;
+#define MAX_UNITS ((int) (sizeof(swapDisks)/sizeof(swapDisks[0])))
+
+static Unit units[MAX_UNITS];
+static int numUnits;
+
+static int  SlotUnit(int slot);
+static void UnitOrder(int *order);
+
+// Free swap space is a bitmap with a bit per slot, set if the slot is in
+// use, searched a word at a time. Bits past the last slot are always set.
+// A slot's place on the disk is computed from its index by SlotUnit,
+// SlotTrack and SlotFirst, the only other per-slot data is its reference
+// count.
+#define SLOT_BITS   32              // bits per slotMap word
+static unsigned int *slotMap;
+static int mapWords;
+static int *slotRefs;       // # pages using the slot, more than 1 if copy-on-write
+
+// Swap space is divided into page-sized slots that don't straddle tracks,
+// and slots are handed out in extents of extentPages slots, one track's
+// worth, aligned on a track. A process's pages p and p+1 are then usually
+// next to each other on the disk.
+static int sectorsPerPage;
+static int numSlots;
+static int extentPages;
+
+static int  SlotAlloc(PID pid, int page);
+static void SlotTake(int slot, PID pid, int page);
+static void SlotFree(int slot);
+static int  SlotRunFree(int first, int count);
+static int  SlotFind(int first, int count);
+static int  SlotTrack(int slot);
+static int  SlotFirst(int slot);
+static void SlotFragmentation(void);
+
+// Shadow page tables. Each process gets an array parallel to its USLOSS_PTE
+// array that remembers where each page lives, so finding a page's swap slot
+// is an index instead of a search of the swap space.
+
+#define SHADOW_ON_SWAP  0x1     // the slot holds a copy of the page, which
+                                // is current if the frame isn't dirty
+#define SHADOW_RESIDENT 0x2     // the page is in shadow.frame
+#define SHADOW_BUSY     0x4     // the page is being read or written
+#define SHADOW_IN_POOL  0x8     // the page is compressed in shadow.pool
+#define SHADOW_COW      0x10    // the page shares its slot, and maybe its
+                                // frame, with other processes' pages
+#define SHADOW_DROPPED  0x20    // the process let go of the page while it
+                                // was busy
+
+typedef struct Shadow{
+    int slot;       // swap slot, -1 if no swap space yet
+    int frame;      // frame holding the page, -1 if not resident
+    int state;      // SHADOW_* bits
+    struct PoolEntry *pool; // compressed copy of the page, if SHADOW_IN_POOL
+    int lastRef;    // faultTime the page was last seen referenced, -1 if never
+}Shadow;
+
+static Shadow *shadowTables[P1_MAXPROC];
+
+static Shadow *ShadowGet(PID pid);
+static void    ShadowFree(PID pid);
+
+// Page replacement policies. P3SwapOut asks the policy for a victim, and
+// the policy is told when a page is loaded into a frame. Every policy gets
+// one node per frame, and the ones that remember evicted pages (ARC and
+// CLOCK-Pro) get 2*numFrames ghost nodes after those. All of this is
+// protected by mutex.
+
+#define LIST_T1         0   // ARC: resident pages seen once
+#define LIST_T2         1   // ARC: resident pages seen more than once
+#define LIST_B1         2   // ghosts evicted from T1, CLOCK-Pro's test ghosts
+#define LIST_B2         3   // ghosts evicted from T2
+#define LIST_FREE       4   // unused ghost nodes
+#define NUM_LISTS       5
+
+typedef struct PolicyNode{
+    int list;       // LIST_* the node is on, -1 if none
+    int prev;
+    int next;
+    PID pid;        // ghosts only, the page they remember
+    int page;
+    int age;        // aging: reference history, most recent in bit 7
+    int lastUse;    // WSClock: virtual time the page was last referenced
+    int hot;        // CLOCK-Pro: page is hot
+    int test;       // CLOCK-Pro: cold page is in its test period
+}PolicyNode;
+
+typedef struct Policy{
+    char *name;
+    int  (*select)(void);       // pick an evictable frame, -1 if there isn't one
+    void (*insert)(int frame);  // the frame now holds P3_frameTable[frame]'s page
+}Policy;
+
+static Policy *policy;
+static PolicyNode *nodes;
+static int listHead[NUM_LISTS];
+static int listTail[NUM_LISTS];
+static int listSize[NUM_LISTS];
+static int policyHand;      // shared by the clock-style policies
+static int vtime;           // virtual time, ticks once per replacement
+static int wsTau;           // WSClock: working set window
+static int proHot;          // CLOCK-Pro: # hot pages
+static int proColdTarget;   // CLOCK-Pro: # frames for cold pages
+static int arcTarget;       // ARC: target size of T1
+
+static int  ClockSelect(void);
+static int  WSClockSelect(void);
+static void WSClockInsert(int frame);
+static int  ClockProSelect(void);
+static void ClockProInsert(int frame);
+static int  ArcSelect(void);
+static int  ListClean(int node);
+static void ArcInsert(int frame);
+static int  AgingSelect(void);
+static void AgingInsert(int frame);
+
+static Policy policies[P3_NUM_POLICIES] = {
+    [P3_POLICY_CLOCK]       = {"clock",     ClockSelect,    NULL},
+    [P3_POLICY_WSCLOCK]     = {"WSClock",   WSClockSelect,  WSClockInsert},
+    [P3_POLICY_CLOCKPRO]    = {"CLOCK-Pro", ClockProSelect, ClockProInsert},
+    [P3_POLICY_ARC]         = {"ARC",       ArcSelect,      ArcInsert},
+    [P3_POLICY_AGING]       = {"aging",     AgingSelect,    AgingInsert},
+};
+
+// Load control. A process's working set is the pages it referenced in the
+// last wsWindow faults, resident or not. Every wsInterval faults the
+// pagers note which resident pages have their reference bit set, and if
+// the working sets of the running processes add up to more than memory
+// the system is thrashing, so the lowest-priority processes are suspended
+// until the rest fit. A suspended process blocks in P3SwapAdmit at its
+// next fault, and the cleaner pages out its frames so that the running
+// processes can have them. It is resumed
+// once its working set fits again. A suspended process's estimate keeps
+// aging, since it isn't referencing anything, so it fits eventually. If
+// nothing has faulted for a while, e.g. a parent is waiting for a
+// suspended child, the Resumer lets a suspended process back in. The reference bits
+// are left for the replacement policy to clear, which it does often enough
+// when memory is tight.
+
+typedef struct Load{
+    int suspended;
+    int waiting;    // blocked in P3SwapAdmit
+    int wake;       // semaphore it is blocked on
+    int ws;         // working set estimate
+    int resident;   // # frames holding the process's pages
+    int target;     // resident-set target set by PFF
+    int lastFault;  // the process's CPU time at its last fault, -1 if none
+    int limit;      // max # frames, 0 if no limit (P3_VmSetLimit)
+    int priority;   // the process's priority, -1 if not looked up yet
+}Load;
+
+static Load load[P1_MAXPROC];
+static int numSuspended;
+static int faultTime;       // virtual time, ticks once per P3SwapIn
+static int wsWindow;
+static int wsInterval;
+
+// Page-fault-frequency frame allocation. Each time a process faults its
+// resident-set target grows by a frame if it has used less than
+// P3_PFF_FAST of CPU time since its previous fault, and shrinks if it
+// has used more than P3_PFF_SLOW. The interval is measured in the
+// process's own CPU time, so other processes' faults don't move its
+// target. While any process is over its target the replacement policy
+// only picks frames of processes that are over their targets.
+static int overTarget;      // # processes over their targets
+static int pffRelaxed;      // ignore the targets, their frames are all busy
+static int localPid;        // only replace this process's pages, -1 if any
+
+static void PffFault(PID pid);
+static void PffResident(PID pid, int delta);
+
+static void LoadControl(int sample);
+static void LoadResume(PID pid);
+static int  LoadPriority(PID pid);
+static int  SuspendedFrame(void);
+
+static void PolicyInit(void);
+static void PolicyForget(int frame);
+static void PolicyRelease(PID pid);
+static void ListAppend(int list, int node);
+static void ListRemove(int node);
+static void GhostAdd(int list, PID pid, int page);
+static int  GhostFind(PID pid, int page);
+
+// Compressed swap cache. Dirty pages that P3SwapOut evicts are compressed
+// into memory and only go to the disk if they don't compress or the pool
+// is full. A page in the pool has a slot like any other, so it can always
+// be sent to the disk later. The pool holds at most poolSize bytes of
+// compressed data, P3_ZPOOL_PERCENT of physical memory. When a page
+// doesn't fit the cleaner writes the oldest entries back to their slots.
+// A cloned page shares its parent's entry, always the same page number
+// in each process, and all of them share the slot too.
+
+typedef struct PoolEntry{
+    int page;
+    int refs;                   // # of shadows pointing at the entry
+    int size;
+    unsigned char *data;
+    struct PoolEntry *older;
+    struct PoolEntry *newer;
+}PoolEntry;
+
+static int poolSize;
+static int poolUsed;
+static int poolFull = FALSE;        // the cleaner should make room
+static PoolEntry *poolOldest;
+static PoolEntry *poolNewest;
+static unsigned char *poolBuffer;   // scratch page to compress into
+static unsigned char *poolOut;      // the cleaner decompresses into this
+
+static int  PoolStore(int frame, PID pid, int page);
+static int  PoolLoad(int frame, PID pid, int page);
+static void PoolRelease(PoolEntry *entry);
+static void PoolDrop(Shadow *shadow);
+static int  PoolWriteBack(PoolEntry *entry);
+static int  Compress(unsigned char *src, int len, unsigned char *dst, int max);
+static void Decompress(unsigned char *src, int len, unsigned char *dst);
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapInit --
+ *
+ *  Initializes the swap data structures.
+ *
+ * Results:
+ *   P3_ALREADY_INITIALIZED:    this function has already been called
+ *   P3_INVALID_POLICY:         P3_vmPolicy isn't a policy
+ *   P3_INVALID_SWAP_DISK:      a disk in P3_SWAP_DISKS doesn't exist, is
+ *                              listed twice, or has a different sector
+ *                              or track size than the first one
+ *   P1_SUCCESS:                success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapInit(int pages, int frames)
+{
+    int result = P1_SUCCESS;
+
+    // initialize the swap data structures, e.g. the pool of free blocks
+    if(initialized==TRUE){
+        return P3_ALREADY_INITIALIZED;
+    }
+    if(P3_vmPolicy<0||P3_vmPolicy>=P3_NUM_POLICIES){
+        return P3_INVALID_POLICY;
+    }
+    // slot addresses are computed from one geometry, so every swap disk
+    // must have the same sector and track sizes
+    int tracks[MAX_UNITS];
+    numUnits = MAX_UNITS;
+    for(int u=0;u<numUnits;u++){
+        int sector;
+        int track;
+        if(swapDisks[u]<0||swapDisks[u]>=USLOSS_DISK_UNITS){
+            return P3_INVALID_SWAP_DISK;
+        }
+        for(int v=0;v<u;v++){
+            if(swapDisks[v]==swapDisks[u]){
+                return P3_INVALID_SWAP_DISK;
+            }
+        }
+        result = P2_DiskSize(swapDisks[u],&sector,&track,&tracks[u]);
+        if(result!=P1_SUCCESS){
+            return P3_INVALID_SWAP_DISK;
+        }
+        if(u==0){
+            sectorSize = sector;
+            trackSize = track;
+        }else if(sector!=sectorSize||track!=trackSize){
+            return P3_INVALID_SWAP_DISK;
+        }
+        units[u].disk = swapDisks[u];
+    }
+    result = P1_SemCreate("Mutex",1,&mutex);
+    result = P1_SemCreate("ioDone",0,&ioDone);
+    ioWaiters = 0;
+    numFrames = frames;
+    numPages = pages;
+    scan=malloc(sizeof(Scan)*numFrames);
+    scanHead=malloc(sizeof(int)*numFrames);
+    for(int i=0;i<numFrames;i++){
+        scan[i].pid=-1;
+        scan[i].page=-1;
+        scan[i].hash=0;
+        scan[i].next=-1;
+    }
+    PolicyInit();
+    numSlots = 0;
+    sectorsPerPage = USLOSS_MmuPageSize()/sectorSize;
+    for(int u=0;u<numUnits;u++){
+        if(trackSize>=sectorsPerPage){
+            extentPages = trackSize/sectorsPerPage;
+            units[u].slots = tracks[u]*extentPages;
+        }else{
+            // pages are bigger than tracks, just lay them end to end
+            extentPages = 1;
+            units[u].slots = (tracks[u]*trackSize)/sectorsPerPage;
+        }
+        units[u].base = numSlots;
+        units[u].start = 0;
+        units[u].next = numSlots;
+        units[u].free = units[u].slots;
+        units[u].queue = 0;
+        numSlots += units[u].slots;
+    }
+    mapWords = (numSlots+SLOT_BITS-1)/SLOT_BITS;
+    slotMap = malloc(sizeof(unsigned int)*mapWords);
+    slotRefs = malloc(sizeof(int)*numSlots);
+    for(int i=0;i<mapWords;i++){
+        slotMap[i]=0;
+    }
+    for(int i=numSlots;i<mapWords*SLOT_BITS;i++){
+        slotMap[i/SLOT_BITS] |= 1u<<(i%SLOT_BITS);
+    }
+    for(int i=0;i<numSlots;i++){
+        slotRefs[i]=0;
+    }
+    P3_vmStats.blocks = numSlots;
+    P3_vmStats.freeBlocks = numSlots;
+    P3_vmStats.largestFree = numSlots;
+    P3_vmStats.fragFree = numSlots;
+    for(int i=0;i<P1_MAXPROC;i++){
+        shadowTables[i]=NULL;
+    }
+    poolSize = (numFrames*USLOSS_MmuPageSize()/100)*P3_ZPOOL_PERCENT;
+    poolUsed = 0;
+    poolFull = FALSE;
+    poolOldest = NULL;
+    poolNewest = NULL;
+    poolBuffer = malloc(USLOSS_MmuPageSize());
+    poolOut = malloc(USLOSS_MmuPageSize());
+    cleanLow = (numFrames*P3_CLEAN_LOW)/100;
+    cleanHigh = (numFrames*P3_CLEAN_HIGH)/100;
+    if(cleanLow<1){
+        cleanLow=1;
+    }
+    if(cleanHigh<cleanLow){
+        cleanHigh=cleanLow;
+    }
+    faultTime = 0;
+    wsWindow = 2*numFrames;
+    wsInterval = (numFrames>=4) ? numFrames/4 : 1;
+    overTarget = 0;
+    pffRelaxed = FALSE;
+    localPid = -1;
+    numSuspended = 0;
+    for(int i=0;i<P1_MAXPROC;i++){
+        char name[P1_MAXNAME+1];
+        snprintf(name,sizeof(name),"Admit %d",i);
+        load[i].suspended = FALSE;
+        load[i].waiting = FALSE;
+        load[i].ws = 0;
+        load[i].resident = 0;
+        load[i].target = numFrames;
+        load[i].lastFault = -1;
+        load[i].limit = 0;
+        load[i].priority = -1;
+        result = P1_SemCreate(name,0,&load[i].wake);
+    }
+    cleanerIdle = FALSE;
+    cleanerShutdown = FALSE;
+    result = P1_SemCreate("cleanerWork",0,&cleanerWork);
+    result = P1_SemCreate("cleanerDone",0,&cleanerDone);
+    mergerIdle = FALSE;
+    mergerShutdown = FALSE;
+    mergeTime = 0;
+    result = P1_SemCreate("mergerWork",0,&mergerWork);
+    result = P1_SemCreate("mergerDone",0,&mergerDone);
+    resumerIdle = FALSE;
+    resumerShutdown = FALSE;
+    result = P1_SemCreate("resumerWork",0,&resumerWork);
+    result = P1_SemCreate("resumerDone",0,&resumerDone);
+    initialized=TRUE;
+    result = P1_Fork("Cleaner",Cleaner,NULL,USLOSS_MIN_STACK * 4,P3_CLEANER_PRIORITY,0,&cleanerPID);
+    result = P1_Fork("Merger",Merger,NULL,USLOSS_MIN_STACK * 4,P3_MERGE_PRIORITY,0,&mergerPID);
+    result = P1_Fork("Resumer",Resumer,NULL,USLOSS_MIN_STACK * 4,P3_RESUME_PRIORITY,0,&resumerPID);
+    return result;
+}
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapShutdown --
+ *
+ *  Cleans up the swap data structures.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapShutdown(void)
+{
+    if( initialized == FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    int result = P1_SUCCESS;
+
+    // stop the cleaner, it may be in the middle of a write
+    result = P1_P(mutex);
+    cleanerShutdown = TRUE;
+    CleanerKick();
+    mergerShutdown = TRUE;
+    MergerKick();
+    resumerShutdown = TRUE;
+    ResumerKick();
+    result = P1_V(mutex);
+    result = P1_P(cleanerDone);
+    result = P1_P(mergerDone);
+    result = P1_P(resumerDone);
+
+    // clean things up
+    for(int i=0;i<P1_MAXPROC;i++){
+        ShadowFree(i);
+    }
+    free(poolBuffer);
+    free(poolOut);
+    free(nodes);
+    free(scan);
+    free(scanHead);
+    free(slotMap);
+    free(slotRefs);
+    result = P1_SemFree(mutex);
+    result = P1_SemFree(ioDone);
+    result = P1_SemFree(cleanerWork);
+    result = P1_SemFree(cleanerDone);
+    result = P1_SemFree(mergerWork);
+    result = P1_SemFree(mergerDone);
+    result = P1_SemFree(resumerWork);
+    result = P1_SemFree(resumerDone);
+    for(int i=0;i<P1_MAXPROC;i++){
+        result = P1_SemFree(load[i].wake);
+    }
+    initialized = FALSE;
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapFreeAll --
+ *
+ *  Frees all swap space used by a process
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+
+int
+P3SwapFreeAll(int pid)
+{
+    int result = P1_SUCCESS;
+    int rc;
+
+    /*****************
+
+    P(mutex)
+    free all swap space used by the process
+    V(mutex)
+
+    *****************/
+    if(pid<0||pid>=P1_MAXPROC){
+        return P1_INVALID_PID;
+    }
+    result = P1_P(mutex);
+    Shadow *shadow = shadowTables[pid];
+    // a pager may still be writing one of the process's pages out
+    for(int i=0;shadow!=NULL&&i<numPages;i++){
+        if(shadow[i].state & SHADOW_BUSY){
+            WaitIO();
+            shadow = shadowTables[pid];
+            i = -1;
+        }
+    }
+    // Every page the process touched has a slot. Freeing a slot is just
+    // bookkeeping, whatever is on the disk gets overwritten by the next
+    // owner. A copy-on-write slot is freed by the last process using it.
+    for(int i=0;shadow!=NULL&&i<numPages;i++){
+        // P3FrameFreeAll normally let go of the process's frames already,
+        // but a page can come back if it couldn't be written out
+        if(shadow[i].state & SHADOW_RESIDENT){
+            int frame = shadow[i].frame;
+            if(FrameDrop(pid,i)==TRUE){
+                rc = P3FrameRelease(frame);
+            }
+        }
+        if(shadow[i].slot!=-1){
+            SlotFree(shadow[i].slot);
+        }
+    }
+    PolicyRelease(pid);
+    ShadowFree(pid);
+    // the process may have left holes in swap
+    SlotFragmentation();
+    // its memory may let a suspended process back in
+    PffResident(pid,-load[pid].resident);
+    load[pid].target = numFrames;
+    load[pid].lastFault = -1;
+    load[pid].limit = 0;
+    load[pid].priority = -1;
+    if(load[pid].suspended==TRUE){
+        load[pid].suspended = FALSE;
+        numSuspended--;
+    }
+    load[pid].ws = 0;
+    LoadControl(FALSE);
+    result = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapHasPage --
+ *
+ *  Tells whether a copy of the page is on the swap disk or in the
+ *  compressed pool, i.e. whether P3SwapIn will fill in the page rather
+ *  than return P3_EMPTY_PAGE.
+ *
+ * Results:
+ *   TRUE if the page is swapped out, FALSE otherwise
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapHasPage(int pid, int page)
+{
+    int result = FALSE;
+    if(initialized==FALSE||pid<0||pid>=P1_MAXPROC||page<0||page>=numPages){
+        return FALSE;
+    }
+    int rc = P1_P(mutex);
+    if(shadowTables[pid]!=NULL&&
+       (shadowTables[pid][page].state & (SHADOW_ON_SWAP|SHADOW_IN_POOL))){
+        result = TRUE;
+    }
+    rc = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotAlloc --
+ *
+ *  Allocates a swap slot for a page. The pages of a process are laid out
+ *  in ranges of extentPages pages, each in its own track-aligned extent.
+ *  If another page in the page's range has a slot, the page gets the
+ *  slot at its offset in the same extent, if that slot is free. The
+ *  first page of a range to get a slot starts an extent that is entirely
+ *  free, so the rest of the range is likely to find its slots free too,
+ *  but nothing is reserved for pages that are never touched. If no whole
+ *  extent is free the page gets any free slot. Units are tried least
+ *  busy first, see UnitOrder. Call with mutex held.
+ *
+ * Results:
+ *   The slot, or -1 if swap is full.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotAlloc(PID pid, int page)
+{
+    Shadow *shadow = shadowTables[pid];
+    int base = (page/extentPages)*extentPages;
+    int count = extentPages;
+    if(base+count>numPages){
+        count = numPages-base;
+    }
+    // go next to the pages in the range that already have slots
+    for(int q=base;q<base+count;q++){
+        int slot = shadow[q].slot;
+        if(q==page||slot==-1){
+            continue;
+        }
+        Unit *unit = &units[SlotUnit(slot)];
+        int want = slot+(page-q);
+        if(want<unit->base||want>=unit->base+unit->slots||
+           (want-unit->base)/extentPages!=(slot-unit->base)/extentPages){
+            continue;
+        }
+        if(SlotRunFree(want,1)==TRUE){
+            SlotTake(want, pid, page);
+            return want;
+        }
+    }
+    int order[MAX_UNITS];
+    UnitOrder(order);
+    for(int o=0;o<numUnits;o++){
+        Unit *unit = &units[order[o]];
+        int numExtents = unit->slots/extentPages;
+        for(int n=0;n<numExtents;n++){
+            int extent = unit->base+((unit->start+n)%numExtents)*extentPages;
+            if(SlotRunFree(extent,count)==TRUE){
+                unit->start = (unit->start+n+1)%numExtents;
+                SlotTake(extent+(page-base), pid, page);
+                return extent+(page-base);
+            }
+        }
+    }
+    // no room for a whole extent, take the first free slot from where
+    // the last search on the unit stopped
+    for(int o=0;o<numUnits;o++){
+        Unit *unit = &units[order[o]];
+        int slot = SlotFind(unit->next,unit->base+unit->slots-unit->next);
+        if(slot==-1){
+            slot = SlotFind(unit->base,unit->next-unit->base);
+        }
+        if(slot!=-1){
+            unit->next = slot;
+            SlotTake(slot, pid, page);
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * UnitOrder --
+ *
+ *  Fills in order with the swap units, the one with the fewest reads
+ *  and writes in progress first. Ties go to the unit with more free
+ *  slots. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+UnitOrder(int *order)
+{
+    for(int u=0;u<numUnits;u++){
+        int k = u;
+        while(k>0&&(units[order[k-1]].queue>units[u].queue||
+                    (units[order[k-1]].queue==units[u].queue&&
+                     units[order[k-1]].free<units[u].free))){
+            order[k] = order[k-1];
+            k--;
+        }
+        order[k] = u;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotUnit --
+ *
+ *  Returns the index in units of the swap unit a slot is on.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotUnit(int slot)
+{
+    int u = numUnits-1;
+    while(u>0&&slot<units[u].base){
+        u--;
+    }
+    return u;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotTake --
+ *
+ *  Assigns a free slot to a page. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SlotTake(int slot, PID pid, int page)
+{
+    slotMap[slot/SLOT_BITS] |= 1u<<(slot%SLOT_BITS);
+    slotRefs[slot] = 1;
+    shadowTables[pid][page].slot = slot;
+    units[SlotUnit(slot)].free--;
+    P3_vmStats.freeBlocks--;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotFree --
+ *
+ *  Drops a page's reference to a slot, and frees the slot if it was
+ *  the last one. Freeing a slot is just bookkeeping, whatever is on the
+ *  disk gets overwritten by the next owner. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SlotFree(int slot)
+{
+    slotRefs[slot]--;
+    if(slotRefs[slot]==0){
+        slotMap[slot/SLOT_BITS] &= ~(1u<<(slot%SLOT_BITS));
+        units[SlotUnit(slot)].free++;
+        P3_vmStats.freeBlocks++;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotRunFree --
+ *
+ *  Tells whether count slots starting at first are all free, checking
+ *  up to a word of the bitmap at a time. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotRunFree(int first, int count)
+{
+    while(count>0){
+        int bit = first%SLOT_BITS;
+        int n = SLOT_BITS-bit;
+        if(n>count){
+            n = count;
+        }
+        unsigned int mask = (n==SLOT_BITS) ? ~0u : ((1u<<n)-1)<<bit;
+        if(slotMap[first/SLOT_BITS] & mask){
+            return FALSE;
+        }
+        first += n;
+        count -= n;
+    }
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotFind --
+ *
+ *  Finds the first free slot among count slots starting at first,
+ *  a word of the bitmap at a time. Call with mutex held.
+ *
+ * Results:
+ *   The slot, or -1 if they are all in use.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotFind(int first, int count)
+{
+    int end = first+count;
+    int slot = first;
+    while(slot<end){
+        int w = slot/SLOT_BITS;
+        unsigned int bits = ~slotMap[w] & (~0u<<(slot%SLOT_BITS));
+        if(bits!=0){
+            slot = w*SLOT_BITS+__builtin_ctz(bits);
+            return (slot<end) ? slot : -1;
+        }
+        slot = (w+1)*SLOT_BITS;
+    }
+    return -1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotTrack --
+ *
+ *  Returns the track a slot is on, within its unit.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotTrack(int slot)
+{
+    slot -= units[SlotUnit(slot)].base;
+    if(trackSize>=sectorsPerPage){
+        return slot/extentPages;
+    }
+    return (slot*sectorsPerPage)/trackSize;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotFirst --
+ *
+ *  Returns the first sector of a slot within its track.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SlotFirst(int slot)
+{
+    slot -= units[SlotUnit(slot)].base;
+    if(trackSize>=sectorsPerPage){
+        return (slot%extentPages)*sectorsPerPage;
+    }
+    return (slot*sectorsPerPage)%trackSize;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SlotFragmentation --
+ *
+ *  Finds the longest run of free slots, and if the free slots are more
+ *  fragmented than they have been so far, i.e. the run is a smaller
+ *  part of the free slots, records it and the number of free slots in
+ *  P3_vmStats.largestFree and fragFree. Whole words of the bitmap are
+ *  skipped at once if they are all free or all in use. This is a scan
+ *  of the whole bitmap, so it is only done when a process quits and
+ *  leaves holes in swap, not on every allocation. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SlotFragmentation(void)
+{
+    int largest = 0;
+    for(int u=0;u<numUnits;u++){
+        // runs don't continue onto the next unit
+        int run = 0;
+        int end = units[u].base+units[u].slots;
+        int slot = units[u].base;
+        while(slot<end){
+            unsigned int word = slotMap[slot/SLOT_BITS];
+            if(slot%SLOT_BITS==0&&slot+SLOT_BITS<=end&&(word==0||word==~0u)){
+                if(word==0){
+                    run += SLOT_BITS;
+                }else{
+                    if(run>largest){
+                        largest = run;
+                    }
+                    run = 0;
+                }
+                slot += SLOT_BITS;
+                continue;
+            }
+            if(word & (1u<<(slot%SLOT_BITS))){
+                if(run>largest){
+                    largest = run;
+                }
+                run = 0;
+            }else{
+                run++;
+            }
+            slot++;
+        }
+        if(run>largest){
+            largest = run;
+        }
+    }
+    int numFree = P3_vmStats.freeBlocks;
+    if(numFree>0&&largest*P3_vmStats.fragFree<P3_vmStats.largestFree*numFree){
+        P3_vmStats.largestFree = largest;
+        P3_vmStats.fragFree = numFree;
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ShadowGet --
+ *
+ *  Returns the shadow page table for a process, allocating it the
+ *  first time one of the process's pages is swapped in. Call with
+ *  mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static Shadow *
+ShadowGet(PID pid)
+{
+    if(shadowTables[pid]==NULL){
+        shadowTables[pid]=malloc(sizeof(Shadow)*numPages);
+        for(int i=0;i<numPages;i++){
+            shadowTables[pid][i].slot=-1;
+            shadowTables[pid][i].frame=-1;
+            shadowTables[pid][i].state=0;
+            shadowTables[pid][i].pool=NULL;
+            shadowTables[pid][i].lastRef=-1;
+        }
+    }
+    return shadowTables[pid];
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ShadowFree --
+ *
+ *  Frees the shadow page table for a process, and any of its pages
+ *  that are in the compressed pool. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ShadowFree(PID pid)
+{
+    if(shadowTables[pid]!=NULL){
+        for(int i=0;i<numPages;i++){
+            PoolDrop(&shadowTables[pid][i]);
+        }
+    }
+    free(shadowTables[pid]);
+    shadowTables[pid]=NULL;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolStore --
+ *
+ *  Tries to compress the page in a frame into the pool. Fails if the
+ *  pool is disabled, the page doesn't shrink, or it doesn't fit in what
+ *  is left of the pool, in which case the cleaner is asked to make room.
+ *  Any copy of the page on the disk is out of date once the page is in
+ *  the pool. The frame and the page must be busy, the mutex is released
+ *  while the page is compressed. Call with mutex held.
+ *
+ * Results:
+ *   TRUE if the page is now in the pool, FALSE if it must be written
+ *   to the disk.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+PoolStore(int frame, PID pid, int page)
+{
+    void *addr;
+    int pageSize = USLOSS_MmuPageSize();
+    int max = pageSize-1;
+    int rc;
+
+    int room = TRUE;
+
+    if(poolSize==0){
+        return FALSE;
+    }
+    if(poolSize-poolUsed<max){
+        max = poolSize-poolUsed;
+        room = FALSE;
+    }
+    int size = -1;
+    unsigned char *data = NULL;
+    if(max>0){
+        rc = P3FrameMap(frame,&addr);
+        if(rc!=P1_SUCCESS){
+            return FALSE;
+        }
+        data = malloc(max);
+        rc = P1_V(mutex);
+        size = Compress(addr,pageSize,data,max);
+        rc = P1_P(mutex);
+        rc = P3FrameUnmap(frame);
+        // the pool may have filled up in the meantime
+        if(size>poolSize-poolUsed){
+            size = -1;
+            room = FALSE;
+        }
+    }
+    if(size==-1){
+        free(data);
+        if(room==FALSE){
+            poolFull = TRUE;
+            CleanerKick();
+        }
+        return FALSE;
+    }
+    PoolEntry *entry = malloc(sizeof(PoolEntry));
+    entry->page = page;
+    entry->refs = 1;
+    entry->size = size;
+    entry->data = realloc(data,size);
+    entry->older = poolNewest;
+    entry->newer = NULL;
+    if(poolNewest!=NULL){
+        poolNewest->newer = entry;
+    }else{
+        poolOldest = entry;
+    }
+    poolNewest = entry;
+    Shadow *shadow = &shadowTables[pid][page];
+    shadow->pool = entry;
+    shadow->state |= SHADOW_IN_POOL;
+    shadow->state &= ~SHADOW_ON_SWAP;
+    poolUsed += size;
+    P3_vmStats.poolStores++;
+    P3_vmStats.poolBytes += size;
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolLoad --
+ *
+ *  Decompresses a page from the pool into a frame and drops it from the
+ *  pool. The frame is left dirty since it now holds the only copy of the
+ *  page. The mutex is released while the page is decompressed, the
+ *  entry is held so that it stays put if the cleaner writes it back in
+ *  the meantime. The frame must be busy. Call with mutex held.
+ *
+ * Results:
+ *   P1_SUCCESS:            the frame holds the page
+ *   other:                 the result of P3FrameMap, the page is still
+ *                          in the pool
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+PoolLoad(int frame, PID pid, int page)
+{
+    void *addr;
+    int rc;
+    int result;
+    Shadow *shadow = &shadowTables[pid][page];
+    PoolEntry *entry = shadow->pool;
+
+    entry->refs++;
+    rc = P1_V(mutex);
+    result = P3FrameMap(frame,&addr);
+    if(result==P1_SUCCESS){
+        Decompress(entry->data,entry->size,addr);
+        rc = P3FrameUnmap(frame);
+        rc = USLOSS_MmuSetAccess(frame,USLOSS_MMU_DIRTY);
+    }
+    rc = P1_P(mutex);
+    shadow = &shadowTables[pid][page];
+    if(result==P1_SUCCESS&&shadow->pool==entry){
+        PoolDrop(shadow);
+    }
+    PoolRelease(entry);
+    if(result!=P1_SUCCESS){
+        return result;
+    }
+    P3_vmStats.poolHits++;
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolDrop --
+ *
+ *  Lets go of the compressed copy of a page, if it has one, and frees
+ *  the copy if no other page is using it. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PoolDrop(Shadow *shadow)
+{
+    if(shadow->state & SHADOW_IN_POOL){
+        PoolEntry *entry = shadow->pool;
+        shadow->pool = NULL;
+        shadow->state &= ~SHADOW_IN_POOL;
+        PoolRelease(entry);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolRelease --
+ *
+ *  Drops a reference to a pool entry and frees it when nothing refers
+ *  to it any more. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PoolRelease(PoolEntry *entry)
+{
+    entry->refs--;
+    if(entry->refs==0){
+        if(entry->older!=NULL){
+            entry->older->newer = entry->newer;
+        }else{
+            poolOldest = entry->newer;
+        }
+        if(entry->newer!=NULL){
+            entry->newer->older = entry->older;
+        }else{
+            poolNewest = entry->older;
+        }
+        poolUsed -= entry->size;
+        free(entry->data);
+        free(entry);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PoolWriteBack --
+ *
+ *  Writes a compressed page back to its slot and takes it out of the
+ *  pool. The pages using the entry are busy during the write, and the
+ *  entry is held while the mutex is released to decompress and write
+ *  it. Only the cleaner calls this, poolOut is its buffer. Call with
+ *  mutex held.
+ *
+ * Results:
+ *   The result of P2_DiskWrite. The page stays in the pool if it fails.
+ *   P1_SUCCESS without writing if only a pager loading the page still
+ *   holds the entry.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+PoolWriteBack(PoolEntry *entry)
+{
+    int page = entry->page;
+    int slot = -1;
+    int rc;
+    int result;
+    int marked[P1_MAXPROC];
+
+    for(int pid=0;pid<P1_MAXPROC;pid++){
+        Shadow *shadow = shadowTables[pid];
+        marked[pid] = FALSE;
+        if(shadow!=NULL&&shadow[page].pool==entry){
+            shadow[page].state |= SHADOW_BUSY;
+            slot = shadow[page].slot;
+            marked[pid] = TRUE;
+        }
+    }
+    if(slot==-1){
+        // only a pager loading the page still holds it
+        return P1_SUCCESS;
+    }
+    Unit *unit = &units[SlotUnit(slot)];
+    unit->queue++;
+    entry->refs++;
+    rc = P1_V(mutex);
+    Decompress(entry->data,entry->size,poolOut);
+    result = P2_DiskWrite(unit->disk,SlotTrack(slot),SlotFirst(slot),sectorsPerPage,poolOut);
+    rc = P1_P(mutex);
+    unit->queue--;
+    // a pager that was already loading the page may have dropped it
+    for(int pid=0;pid<P1_MAXPROC;pid++){
+        Shadow *shadow = shadowTables[pid];
+        if(marked[pid]==FALSE||shadow==NULL){
+            continue;
+        }
+        shadow[page].state &= ~SHADOW_BUSY;
+        if(result==P1_SUCCESS&&shadow[page].pool==entry){
+            shadow[page].state |= SHADOW_ON_SWAP;
+            PoolDrop(&shadow[page]);
+        }
+    }
+    PoolRelease(entry);
+    if(result==P1_SUCCESS){
+        P3_vmStats.pageOuts++;
+    }
+    CompleteIO();
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Compress --
+ *
+ *  Run-length encodes len bytes. Each run starts with a control byte c:
+ *  if c < 128 then c+1 literal bytes follow, otherwise the next byte is
+ *  repeated c-125 times (runs of 3 to 130 bytes). Zero-filled and
+ *  pattern-filled pages shrink to a few bytes.
+ *
+ * Results:
+ *   The compressed size, or -1 if it would be more than max bytes.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Compress(unsigned char *src, int len, unsigned char *dst, int max)
+{
+    int i = 0;
+    int n = 0;
+    while(i<len){
+        int run = 1;
+        while(i+run<len&&run<130&&src[i+run]==src[i]){
+            run++;
+        }
+        if(run>=3){
+            if(n+2>max){
+                return -1;
+            }
+            dst[n++] = 128+run-3;
+            dst[n++] = src[i];
+            i += run;
+        }else{
+            // literals up to the next run of 3
+            int lit = 0;
+            while(i+lit<len&&lit<128){
+                if(i+lit+2<len&&src[i+lit]==src[i+lit+1]&&src[i+lit]==src[i+lit+2]){
+                    break;
+                }
+                lit++;
+            }
+            if(n+1+lit>max){
+                return -1;
+            }
+            dst[n++] = lit-1;
+            memcpy(dst+n,src+i,lit);
+            n += lit;
+            i += lit;
+        }
+    }
+    return n;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Decompress --
+ *
+ *  Undoes Compress.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+Decompress(unsigned char *src, int len, unsigned char *dst)
+{
+    int i = 0;
+    while(i<len){
+        int c = src[i++];
+        if(c<128){
+            memcpy(dst,src+i,c+1);
+            dst += c+1;
+            i += c+1;
+        }else{
+            memset(dst,src[i],c-125);
+            dst += c-125;
+            i++;
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameDrop --
+ *
+ *  Takes page of process pid out of the frame it is resident in. If the
+ *  frame is copy-on-write the other pages keep it, and if pid's page
+ *  was the one in P3_frameTable the first sharer takes its place. Call with
+ *  mutex held.
+ *
+ * Results:
+ *   TRUE if the frame is no longer in use, FALSE otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FrameDrop(PID pid, int page)
+{
+    Shadow *shadow = &shadowTables[pid][page];
+    int frame = shadow->frame;
+    shadow->state &= ~SHADOW_RESIDENT;
+    shadow->frame = -1;
+    PffResident(pid,-1);
+    P3_frameTable[frame].refs--;
+    if(P3_frameTable[frame].pid!=pid||P3_frameTable[frame].page!=page){
+        for(P3Sharer **s=&P3_frameTable[frame].sharers;*s!=NULL;s=&(*s)->next){
+            if((*s)->pid==pid&&(*s)->page==page){
+                P3Sharer *gone = *s;
+                *s = gone->next;
+                free(gone);
+                break;
+            }
+        }
+        return FALSE;
+    }
+    if(P3_frameTable[frame].sharers!=NULL){
+        P3Sharer *s = P3_frameTable[frame].sharers;
+        P3_frameTable[frame].pid = s->pid;
+        P3_frameTable[frame].page = s->page;
+        P3_frameTable[frame].sharers = s->next;
+        free(s);
+        return FALSE;
+    }
+    PolicyForget(frame);
+    P3_frameTable[frame].refs = 0;
+    P3_frameTable[frame].pid = -1;
+    P3_frameTable[frame].page = -1;
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameEvictable --
+ *
+ *  Tells whether a frame holds a page that may be taken from its
+ *  process: the frame isn't busy, has an owner (frames without one are
+ *  on the free list), and the owner's PTE still maps it (the owner may
+ *  be quitting and have already given the frame up). Call with mutex
+ *  held.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FrameEvictable(int frame)
+{
+    USLOSS_PTE *table = NULL;
+    if(P3_frameTable[frame].busy==TRUE||P3_frameTable[frame].pid==-1){
+        return FALSE;
+    }
+    int rc = P3PageTableGet(P3_frameTable[frame].pid,&table);
+    if(rc!=P1_SUCCESS||table==NULL){
+        return FALSE;
+    }
+    USLOSS_PTE *pte = table+P3_frameTable[frame].page;
+    if(pte->incore==0||pte->frame!=frame){
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameVictim --
+ *
+ *  Tells whether the replacement policy may pick a frame: it must be
+ *  evictable and, if any process is over its resident-set target,
+ *  belong to one of them. During local replacement it must belong to
+ *  localPid instead. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FrameVictim(int frame)
+{
+    if(FrameEvictable(frame)==FALSE){
+        return FALSE;
+    }
+    PID pid = P3_frameTable[frame].pid;
+    if(localPid!=-1){
+        return (pid==localPid) ? TRUE : FALSE;
+    }
+    if(overTarget>0&&pffRelaxed==FALSE&&load[pid].resident<=load[pid].target){
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PageWrite --
+ *
+ *  Writes count pages of a process, starting at page, from their frames
+ *  to their slots on the swap disk. The slots must be consecutive on one
+ *  track; the frames are mapped next to each other so the whole run goes
+ *  out in a single write. If we can't map the run the pages are written
+ *  one at a time. The mutex is released during the write, so the caller
+ *  must have marked the frames and the pages busy and cleared the
+ *  frames' dirty bits. Pages that can't be written, because a frame
+ *  can't be mapped or the disk write fails, are left dirty and not on
+ *  swap. The frames' reference bits are put back afterwards, the write
+ *  reading a page doesn't mean the page was used. count must be at most
+ *  P3_CLUSTER_MAX. Call with mutex held.
+ *
+ * Results:
+ *   The result of the last P2_DiskWrite, or of P3FrameMap if it failed.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+PageWrite(int *frames, PID pid, int page, int count)
+{
+    void *addr;
+    int index = shadowTables[pid][page].slot;
+    int track = SlotTrack(index);
+    int first = SlotFirst(index);
+    Unit *unit = &units[SlotUnit(index)];
+    int rc;
+    int result;
+
+    int written = 0;
+    int access[P3_CLUSTER_MAX];
+    for(int i=0;i<count;i++){
+        access[i] = 0;
+        rc = USLOSS_MmuGetAccess(frames[i],&access[i]);
+    }
+    unit->queue++;
+    rc = P1_V(mutex);
+    result = P3FrameMapRun(count,frames,&addr);
+    if(result==P1_SUCCESS){
+        result = P2_DiskWrite(unit->disk,track,first,sectorsPerPage*count,addr);
+        for(int i=0;i<count;i++){
+            rc = P3FrameUnmap(frames[i]);
+        }
+        if(result==P1_SUCCESS){
+            written = count;
+        }
+    }else{
+        // no run of free pages, write the frames one at a time
+        for(written=0;written<count;written++){
+            result = P3FrameMap(frames[written],&addr);
+            if(result!=P1_SUCCESS){
+                break;
+            }
+            result = P2_DiskWrite(unit->disk,track,first+written*sectorsPerPage,
+                                  sectorsPerPage,addr);
+            rc = P3FrameUnmap(frames[written]);
+            if(result!=P1_SUCCESS){
+                break;
+            }
+        }
+    }
+    rc = P1_P(mutex);
+    unit->queue--;
+    for(int i=0;i<count;i++){
+        AccessRestore(frames[i],access[i]);
+    }
+    // the caller cleared the dirty bits, set them again on the pages we
+    // couldn't write so that they aren't dropped
+    for(int i=written;i<count;i++){
+        int access;
+        rc = USLOSS_MmuGetAccess(frames[i],&access);
+        rc = USLOSS_MmuSetAccess(frames[i],access|USLOSS_MMU_DIRTY);
+    }
+    for(int i=0;i<written;i++){
+        shadowTables[pid][page+i].state |= SHADOW_ON_SWAP;
+        // if pid quit during the write a sharer may own the frame now
+        PID owner = P3_frameTable[frames[i]].pid;
+        if(owner!=-1){
+            shadowTables[owner][P3_frameTable[frames[i]].page].state |= SHADOW_ON_SWAP;
+        }
+        // copy-on-write sharers use the same slot
+        for(P3Sharer *s=P3_frameTable[frames[i]].sharers;s!=NULL;s=s->next){
+            shadowTables[s->pid][s->page].state |= SHADOW_ON_SWAP;
+        }
+    }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WriteDone --
+ *
+ *  Called by the cleaner and ClusterWrite when they have written a
+ *  frame whose page stayed mapped. If the page's process quit during
+ *  the write it left the frame to us, so we free it. Call with mutex
+ *  held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+WriteDone(int frame)
+{
+    int rc;
+    P3_frameTable[frame].busy=FALSE;
+    if(P3_frameTable[frame].pid==-1){
+        rc = P3FrameRelease(frame);
+        CompleteIO();
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClusterFrame --
+ *
+ *  Decides whether page q of a process can be written to swap in the
+ *  same write as page, which is being evicted. q must be resident, not
+ *  busy or copy-on-write, dirty but not recently referenced, and its
+ *  slot must follow on from page's slot on the same track of the same
+ *  unit. Call with mutex held.
+ *
+ * Results:
+ *   The frame holding q, or -1 if it can't be clustered.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+ClusterFrame(PID pid, int page, int q)
+{
+    if(q<0||q>=numPages){
+        return -1;
+    }
+    Shadow *shadow = &shadowTables[pid][q];
+    int slot = shadowTables[pid][page].slot;
+    if(shadow->slot==-1||shadow->slot!=slot+(q-page)||
+       SlotUnit(shadow->slot)!=SlotUnit(slot)||SlotTrack(shadow->slot)!=SlotTrack(slot)){
+        return -1;
+    }
+    if((shadow->state&(SHADOW_RESIDENT|SHADOW_BUSY|SHADOW_COW))!=SHADOW_RESIDENT){
+        return -1;
+    }
+    int frame = shadow->frame;
+    if(frame==-1||FrameEvictable(frame)==FALSE||P3_frameTable[frame].page!=q){
+        return -1;
+    }
+    int access;
+    int rc = USLOSS_MmuGetAccess(frame,&access);
+    if(rc!=USLOSS_MMU_OK||(access&USLOSS_MMU_DIRTY)==0||(access&USLOSS_MMU_REF)!=0){
+        return -1;
+    }
+    return frame;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClusterWrite --
+ *
+ *  Writes an evicted page to swap, along with the dirty neighbours that
+ *  sit next to it on the disk so they are clean when the clock gets to
+ *  them. The neighbours stay mapped, busy only keeps them from being
+ *  evicted during the write. The caller must have marked the evicted
+ *  page busy and cleared its dirty bit. Call with mutex held.
+ *
+ * Results:
+ *   The result of PageWrite.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+ClusterWrite(int target, PID pid, int page)
+{
+    int rc;
+    int result;
+    int frames[P3_CLUSTER_MAX];
+    int low = page;
+    int high = page;
+    while(high-low+1<P3_CLUSTER_MAX&&ClusterFrame(pid,page,high+1)!=-1){
+        high++;
+    }
+    while(high-low+1<P3_CLUSTER_MAX&&ClusterFrame(pid,page,low-1)!=-1){
+        low--;
+    }
+    for(int q=low;q<=high;q++){
+        if(q==page){
+            frames[q-low] = target;
+            continue;
+        }
+        int f = shadowTables[pid][q].frame;
+        frames[q-low] = f;
+        P3_frameTable[f].busy=TRUE;
+        shadowTables[pid][q].state |= SHADOW_BUSY;
+        int access;
+        rc = USLOSS_MmuGetAccess(f,&access);
+        rc = USLOSS_MmuSetAccess(f,access&USLOSS_MMU_REF);
+    }
+    result = PageWrite(frames,pid,low,high-low+1);
+    for(int q=low;q<=high;q++){
+        if(q==page){
+            continue;
+        }
+        shadowTables[pid][q].state &= ~SHADOW_BUSY;
+        WriteDone(frames[q-low]);
+        P3_vmStats.clustered++;
+    }
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Cleaner --
+ *
+ *  Write-behind daemon. Whenever it is kicked it counts the frames that
+ *  could be handed to a pager without a write (free frames plus clean
+ *  evictable ones). If that is below the low watermark it makes one pass
+ *  over the frames writing dirty, unreferenced pages to swap until the
+ *  high watermark is reached. The page stays mapped during the write,
+ *  the dirty bit is cleared first so a store during the write is not
+ *  lost. If a page didn't fit in the compressed pool it also writes the
+ *  oldest pages in the pool back to swap until the pool is down to
+ *  three quarters full. It also pages out the processes that load
+ *  control has suspended, freeing their frames for the rest.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Cleaner(void *arg)
+{
+    static int hand = -1;
+    int result = P1_SUCCESS;
+    USLOSS_PTE *table = NULL;
+
+    // we need a page table of our own to map frames into
+    result = P3PageTableGet(P1_GetPid(),&table);
+    if(table==NULL){
+        table = P3PageTableAllocateEmpty(numPages);
+        result = P3PageTableSet(P1_GetPid(),table);
+    }
+    result = P1_P(mutex);
+    while(cleanerShutdown==FALSE){
+        while(cleanerShutdown==FALSE&&numSuspended>0&&SuspendedFrame()!=-1){
+            int frame;
+            result = P1_V(mutex);
+            result = SwapOut(SWAP_SUSPENDED,&frame);
+            result = P1_P(mutex);
+            if(frame==-1){
+                break;
+            }
+            // nobody is waiting to swap a page into it, free it
+            P3_frameTable[frame].busy=FALSE;
+            result = P3FrameRelease(frame);
+            CompleteIO();
+        }
+        if(poolFull==TRUE){
+            poolFull = FALSE;
+            while(poolOldest!=NULL&&poolUsed>(poolSize/4)*3&&cleanerShutdown==FALSE){
+                PoolEntry *oldest = poolOldest;
+                result = PoolWriteBack(oldest);
+                if(result!=P1_SUCCESS||poolOldest==oldest){
+                    break;
+                }
+            }
+        }
+        int access;
+        int clean = P3_vmStats.freeFrames;
+        for(int i=0;i<numFrames;i++){
+            if(FrameEvictable(i)==TRUE){
+                result = USLOSS_MmuGetAccess(i,&access);
+                if((access&USLOSS_MMU_DIRTY)==0){
+                    clean++;
+                }
+            }
+        }
+        // once started, keep going up to the high watermark
+        int goal = (clean<cleanLow) ? cleanHigh : 0;
+        for(int i=0;clean<goal&&i<numFrames;i++){
+            hand = (hand+1)%numFrames;
+            if(FrameEvictable(hand)==FALSE){
+                continue;
+            }
+            result = USLOSS_MmuGetAccess(hand,&access);
+            if((access&USLOSS_MMU_DIRTY)==0||(access&USLOSS_MMU_REF)!=0){
+                continue;
+            }
+            PID pid = P3_frameTable[hand].pid;
+            int page = P3_frameTable[hand].page;
+            P3_frameTable[hand].busy=TRUE;
+            shadowTables[pid][page].state |= SHADOW_BUSY;
+            result = USLOSS_MmuSetAccess(hand,access&USLOSS_MMU_REF);
+            debug3("clean pid:%d page:%d frame:%d\n", pid,page,hand);
+            result = PageWrite(&hand,pid,page,1);
+            shadowTables[pid][page].state &= ~SHADOW_BUSY;
+            WriteDone(hand);
+            P3_vmStats.cleaned++;
+            CompleteIO();
+            clean++;
+            if(cleanerShutdown==TRUE){
+                break;
+            }
+        }
+        if(cleanerShutdown==TRUE){
+            break;
+        }
+        if(poolFull==TRUE){
+            // filled up again while we were busy
+            continue;
+        }
+        cleanerIdle = TRUE;
+        result = P1_V(mutex);
+        result = P1_P(cleanerWork);
+        result = P1_P(mutex);
+    }
+    result = P1_V(mutex);
+    result = P1_V(cleanerDone);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CleanerKick --
+ *
+ *  Wakes up the cleaner if it is idle. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+CleanerKick(void)
+{
+    if(cleanerIdle==TRUE){
+        cleanerIdle = FALSE;
+        int rc;
+        rc = P1_V(cleanerWork);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Merger --
+ *
+ *  Same-page merging daemon. Each time it is kicked it makes one pass
+ *  over the frames hashing their contents. A page whose hash hasn't
+ *  changed since the previous pass is stable; if a stable page earlier
+ *  in this pass has the same hash, MergePages tries to put both pages
+ *  in one read-only frame and frees the other frame. Pages that change
+ *  between passes are left alone, merging them would just cost a copy
+ *  on the next write. The mutex is dropped between frames so the
+ *  pagers aren't held up behind a low-priority process.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Merger(void *arg)
+{
+    int result = P1_SUCCESS;
+    USLOSS_PTE *table = NULL;
+
+    // we need a page table of our own to map frames into
+    result = P3PageTableGet(P1_GetPid(),&table);
+    if(table==NULL){
+        table = P3PageTableAllocateEmpty(numPages);
+        result = P3PageTableSet(P1_GetPid(),table);
+    }
+    result = P1_P(mutex);
+    while(mergerShutdown==FALSE){
+        for(int i=0;i<numFrames;i++){
+            scanHead[i] = -1;
+        }
+        for(int i=0;i<numFrames&&mergerShutdown==FALSE;i++){
+            void *addr;
+            // let the pagers in
+            result = P1_V(mutex);
+            result = P1_P(mutex);
+            int access = 0;
+            if(FrameEvictable(i)==FALSE||
+               (shadowTables[P3_frameTable[i].pid][P3_frameTable[i].page].state & SHADOW_BUSY)||
+               USLOSS_MmuGetAccess(i,&access)!=USLOSS_MMU_OK||
+               P3FrameMap(i,&addr)!=P1_SUCCESS){
+                scan[i].pid = -1;
+                continue;
+            }
+            unsigned int hash = PageHash(addr,USLOSS_MmuPageSize());
+            result = P3FrameUnmap(i);
+            AccessRestore(i,access);
+            int stable = (scan[i].pid==P3_frameTable[i].pid&&scan[i].page==P3_frameTable[i].page&&
+                          scan[i].hash==hash) ? TRUE : FALSE;
+            scan[i].pid = P3_frameTable[i].pid;
+            scan[i].page = P3_frameTable[i].page;
+            scan[i].hash = hash;
+            scan[i].next = -1;
+            if(stable==FALSE){
+                continue;
+            }
+            int merged = FALSE;
+            for(int j=scanHead[hash%numFrames];j!=-1&&merged==FALSE;j=scan[j].next){
+                // j may have changed hands since it was hashed
+                if(scan[j].hash!=hash||scan[j].pid!=P3_frameTable[j].pid||
+                   scan[j].page!=P3_frameTable[j].page||FrameEvictable(j)==FALSE){
+                    continue;
+                }
+                if(P3_frameTable[i].refs==1){
+                    merged = MergePages(j,i);
+                }else if(P3_frameTable[j].refs==1&&MergePages(i,j)==TRUE){
+                    // j's frame is free now, i takes its place
+                    scan[j].pid = -1;
+                }
+            }
+            if(merged==FALSE){
+                scan[i].next = scanHead[hash%numFrames];
+                scanHead[hash%numFrames] = i;
+            }
+        }
+        if(mergerShutdown==TRUE){
+            break;
+        }
+        mergerIdle = TRUE;
+        result = P1_V(mutex);
+        result = P1_P(mergerWork);
+        result = P1_P(mutex);
+    }
+    result = P1_V(mutex);
+    result = P1_V(mergerDone);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * Resumer --
+ *
+ *  Load control only runs when a process faults, so a suspended process
+ *  would wait forever if the processes left running stop faulting, e.g.
+ *  a parent waiting for the suspended child. The Resumer runs at the
+ *  lowest priority, but user processes may run at that priority too,
+ *  so getting the CPU doesn't mean nothing else is running. Before it
+ *  resumes anyone it waits P3_RESUME_QUIET microseconds and only goes
+ *  ahead if there were no faults and no swap I/O in that time; then it
+ *  resumes the highest-priority suspended process. It keeps going until
+ *  nobody is suspended.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+Resumer(void *arg)
+{
+    int result = P1_SUCCESS;
+
+    result = P1_P(mutex);
+    while(resumerShutdown==FALSE){
+        int busy = FALSE;
+        for(int u=0;u<numUnits;u++){
+            if(units[u].queue>0){
+                busy = TRUE;
+            }
+        }
+        int next = -1;
+        for(int pid=0;busy==FALSE&&pid<P1_MAXPROC;pid++){
+            if(load[pid].suspended==TRUE&&(next==-1||LoadPriority(pid)<LoadPriority(next))){
+                next = pid;
+            }
+        }
+        if(next!=-1){
+            // wait for the faults to stop
+            int seen = faultTime;
+            int start;
+            int now;
+            result = USLOSS_DeviceInput(USLOSS_CLOCK_DEV,0,&start);
+            now = start;
+            while(faultTime==seen&&resumerShutdown==FALSE&&now-start<P3_RESUME_QUIET){
+                result = P1_V(mutex);
+                result = P1_P(mutex);
+                result = USLOSS_DeviceInput(USLOSS_CLOCK_DEV,0,&now);
+            }
+            if(faultTime!=seen||resumerShutdown==TRUE||load[next].suspended==FALSE){
+                // something is still faulting, start over. Going idle
+                // here could miss the kick from the last fault.
+                continue;
+            }
+            debug3("resume idle pid:%d ws:%d\n", next,load[next].ws);
+            LoadResume(next);
+            // let it run, we're back when everyone is blocked again
+            result = P1_V(mutex);
+            result = P1_P(mutex);
+            continue;
+        }
+        resumerIdle = TRUE;
+        result = P1_V(mutex);
+        result = P1_P(resumerWork);
+        result = P1_P(mutex);
+    }
+    result = P1_V(mutex);
+    result = P1_V(resumerDone);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ResumerKick --
+ *
+ *  Wakes up the Resumer if it is idle. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ResumerKick(void)
+{
+    if(resumerIdle==TRUE){
+        resumerIdle = FALSE;
+        int rc;
+        rc = P1_V(resumerWork);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MergerKick --
+ *
+ *  Wakes up the merger if it is idle. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+MergerKick(void)
+{
+    if(mergerIdle==TRUE){
+        mergerIdle = FALSE;
+        int rc;
+        rc = P1_V(mergerWork);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * MergePages --
+ *
+ *  Merges the page in frame drop onto the page in frame keep if they
+ *  are identical. Both pages are write-protected and marked
+ *  copy-on-write before they are compared, so a process that writes
+ *  one of them faults and waits in P3SwapCowCheck for the mutex. The
+ *  dropped page then shares keep's frame and swap slot exactly as if
+ *  it had been cloned, and drop goes back to the free frames. drop
+ *  must not be shared. Call with mutex held.
+ *
+ * Results:
+ *   TRUE if the pages were merged, FALSE otherwise.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+MergePages(int keep, int drop)
+{
+    int rc;
+    PID apid = P3_frameTable[keep].pid;
+    int apage = P3_frameTable[keep].page;
+    PID bpid = P3_frameTable[drop].pid;
+    int bpage = P3_frameTable[drop].page;
+    Shadow *a = &shadowTables[apid][apage];
+    Shadow *b = &shadowTables[bpid][bpage];
+    USLOSS_PTE *atable = NULL;
+    USLOSS_PTE *btable = NULL;
+
+    if(keep==drop||a->slot==-1||((a->state|b->state) & SHADOW_BUSY)){
+        return FALSE;
+    }
+    rc = P3PageTableGet(apid,&atable);
+    rc = P3PageTableGet(bpid,&btable);
+    if(atable==NULL||btable==NULL){
+        return FALSE;
+    }
+    int aState = a->state;
+    int bState = b->state;
+    int aWrite = (atable+apage)->write;
+    int bWrite = (btable+bpage)->write;
+    (atable+apage)->write = 0;
+    (btable+bpage)->write = 0;
+    a->state |= SHADOW_COW;
+    b->state |= SHADOW_COW;
+    void *from;
+    void *to;
+    int same = FALSE;
+    int keepAccess = 0;
+    int dropAccess = 0;
+    rc = USLOSS_MmuGetAccess(keep,&keepAccess);
+    rc = USLOSS_MmuGetAccess(drop,&dropAccess);
+    if(P3FrameMap(keep,&to)==P1_SUCCESS){
+        if(P3FrameMap(drop,&from)==P1_SUCCESS){
+            same = (memcmp(to,from,USLOSS_MmuPageSize())==0) ? TRUE : FALSE;
+            rc = P3FrameUnmap(drop);
+        }
+        rc = P3FrameUnmap(keep);
+    }
+    AccessRestore(keep,keepAccess);
+    AccessRestore(drop,dropAccess);
+    if(same==FALSE){
+        (atable+apage)->write = aWrite;
+        (btable+bpage)->write = bWrite;
+        a->state = aState;
+        b->state = bState;
+        return FALSE;
+    }
+    // the dropped page gives up its slot and uses keep's, which has a
+    // valid copy of the contents whenever keep's page does
+    if(b->slot!=-1){
+        SlotFree(b->slot);
+    }
+    b->slot = a->slot;
+    slotRefs[a->slot]++;
+    b->state = (b->state & ~SHADOW_ON_SWAP) | (a->state & SHADOW_ON_SWAP);
+    P3Sharer *s = malloc(sizeof(P3Sharer));
+    s->pid = bpid;
+    s->page = bpage;
+    s->next = P3_frameTable[keep].sharers;
+    P3_frameTable[keep].sharers = s;
+    P3_frameTable[keep].refs++;
+    b->frame = keep;
+    (btable+bpage)->frame = keep;
+    PolicyForget(drop);
+    P3_frameTable[drop].pid = -1;
+    P3_frameTable[drop].page = -1;
+    P3_frameTable[drop].refs = 0;
+    rc = P3FrameRelease(drop);
+    // a pager may be waiting for a frame
+    CompleteIO();
+    P3_vmStats.merged++;
+    debug3("merge pid:%d page:%d frame:%d -> pid:%d page:%d frame:%d\n",
+           bpid,bpage,drop,apid,apage,keep);
+    return TRUE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PageHash --
+ *
+ *  FNV-1a hash of len bytes.
+ *
+ *----------------------------------------------------------------------
+ */
+static unsigned int
+PageHash(unsigned char *addr, int len)
+{
+    unsigned int hash = 2166136261u;
+    for(int i=0;i<len;i++){
+        hash ^= addr[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * AccessRestore --
+ *
+ *  Reading a frame through a mapping sets its reference bit. Puts back
+ *  the reference bit the frame had before, as saved by the caller with
+ *  USLOSS_MmuGetAccess, so that a daemon looking at a page doesn't make
+ *  it look recently used to the policies and the working-set sampling.
+ *  The dirty bit is left as it is, a store made by the page's process
+ *  while the frame was mapped must not be lost.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+AccessRestore(int frame, int access)
+{
+    int now;
+    int rc = USLOSS_MmuGetAccess(frame,&now);
+    if(rc==USLOSS_MMU_OK){
+        rc = USLOSS_MmuSetAccess(frame,(now&USLOSS_MMU_DIRTY)|(access&USLOSS_MMU_REF));
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WaitIO --
+ *
+ *  Releases mutex and waits for a pager to finish its I/O, then
+ *  reacquires mutex. The caller must recheck whatever it was waiting
+ *  for, since the completed I/O may not be the one it cares about.
+ *  Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+WaitIO(void)
+{
+    int rc;
+    ioWaiters++;
+    rc = P1_V(mutex);
+    rc = P1_P(ioDone);
+    rc = P1_P(mutex);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * CompleteIO --
+ *
+ *  Wakes up everyone waiting in WaitIO. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+CompleteIO(void)
+{
+    int rc;
+    while(ioWaiters>0){
+        ioWaiters--;
+        rc = P1_V(ioDone);
+    }
+    // the Resumer skips its turn while there is I/O going on
+    if(numSuspended>0){
+        ResumerKick();
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapDropFrame --
+ *
+ *  Called by P3FrameFreeAll for each resident page of a quitting
+ *  process. A copy-on-write frame stays in use by the other processes
+ *  sharing it, and a frame that is being written out is freed by the
+ *  writer once the write is done.
+ *
+ * Results:
+ *   TRUE if the caller should free the frame, FALSE otherwise
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapDropFrame(PID pid, int page)
+{
+    int result = TRUE;
+    if(initialized==FALSE||pid<0||pid>=P1_MAXPROC||page<0||page>=numPages){
+        return TRUE;
+    }
+    int rc = P1_P(mutex);
+    if(shadowTables[pid]!=NULL){
+        Shadow *shadow = &shadowTables[pid][page];
+        if(shadow->state & SHADOW_BUSY){
+            // Being written out. If it is still resident the cleaner or a
+            // clustered write is writing from the frame, and frees it when
+            // it's done (see WriteDone). Otherwise it is being replaced and
+            // the frame belongs to the pager.
+            if(shadow->state & SHADOW_RESIDENT){
+                rc = FrameDrop(pid,page);
+            }
+            shadow->state |= SHADOW_DROPPED;
+            result = FALSE;
+        }else if(shadow->state & SHADOW_RESIDENT){
+            result = FrameDrop(pid,page);
+        }
+    }
+    rc = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapWake --
+ *
+ *  Called by phase 3c when a frame is freed or a page is mapped into a
+ *  frame, so that the frame can be replaced. Wakes up pagers waiting in
+ *  P3SwapOut for a victim.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapWake(void)
+{
+    int result = P1_SUCCESS;
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    result = P1_P(mutex);
+    CompleteIO();
+    result = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapClone --
+ *
+ *  Gives child a copy-on-write copy of parent's address space. Every
+ *  page the parent has touched shares its swap slot with the child's
+ *  page, and if it is resident its frame too, mapped read-only in both
+ *  processes. A write to a shared page faults and P3SwapCowCopy gives
+ *  the writer its own copy. The child must have a page table and must
+ *  not have touched any pages yet.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_INVALID_PID:        a pid is invalid, or the child has pages
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapClone(PID parent, PID child)
+{
+    int result = P1_SUCCESS;
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(parent<0||parent>=P1_MAXPROC||child<0||child>=P1_MAXPROC||parent==child){
+        return P1_INVALID_PID;
+    }
+    USLOSS_PTE *ptable = NULL;
+    USLOSS_PTE *ctable = NULL;
+    result = P3PageTableGet(parent,&ptable);
+    result = P3PageTableGet(child,&ctable);
+    if(ptable==NULL||ctable==NULL){
+        return P1_INVALID_PID;
+    }
+    result = P1_P(mutex);
+    if(shadowTables[child]!=NULL){
+        result = P1_V(mutex);
+        return P1_INVALID_PID;
+    }
+    Shadow *ps = shadowTables[parent];
+    // wait for the parent's pages to stop moving
+    for(int i=0;ps!=NULL&&i<numPages;i++){
+        if(ps[i].state & SHADOW_BUSY){
+            WaitIO();
+            ps = shadowTables[parent];
+            i = -1;
+        }
+    }
+    if(ps==NULL){
+        // nothing to share
+        result = P1_V(mutex);
+        return result;
+    }
+    Shadow *cs = ShadowGet(child);
+    for(int page=0;page<numPages;page++){
+        Shadow *p = &ps[page];
+        Shadow *c = &cs[page];
+        if(p->slot==-1){
+            continue;
+        }
+        c->slot = p->slot;
+        slotRefs[p->slot]++;
+        c->state = p->state & SHADOW_ON_SWAP;
+        c->lastRef = p->lastRef;
+        if(p->state & SHADOW_IN_POOL){
+            // share the compressed copy, it takes no more of the pool
+            c->pool = p->pool;
+            c->pool->refs++;
+            c->state |= SHADOW_IN_POOL;
+        }
+        p->state |= SHADOW_COW;
+        c->state |= SHADOW_COW;
+        if(p->state & SHADOW_RESIDENT){
+            int frame = p->frame;
+            P3Sharer *s = malloc(sizeof(P3Sharer));
+            s->pid = child;
+            s->page = page;
+            s->next = P3_frameTable[frame].sharers;
+            P3_frameTable[frame].sharers = s;
+            P3_frameTable[frame].refs++;
+            c->state |= SHADOW_RESIDENT;
+            c->frame = frame;
+            PffResident(child,1);
+            (ptable+page)->write = 0;
+            ctable[page] = ptable[page];
+        }
+    }
+    if(P1_GetPid()==parent){
+        result = USLOSS_MmuSetPageTable(ptable);
+    }
+    debug3("clone %d -> %d\n", parent,child);
+    result = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapCowCheck --
+ *
+ *  Tells whether a page is copy-on-write. A copy-on-write page that is
+ *  no longer shared with anyone stops being copy-on-write.
+ *
+ * Results:
+ *   P3_COW_NONE:       the page isn't copy-on-write
+ *   P3_COW_PRIVATE:    the page was copy-on-write, it can be written now
+ *   P3_COW_SHARED:     the page is shared, it must be mapped read-only
+ *                      and a write to it must go through P3SwapCowCopy
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapCowCheck(PID pid, int page)
+{
+    int result = P3_COW_NONE;
+    if(initialized==FALSE||pid<0||pid>=P1_MAXPROC||page<0||page>=numPages){
+        return P3_COW_NONE;
+    }
+    int rc = P1_P(mutex);
+    Shadow *shadow = (shadowTables[pid]!=NULL) ? &shadowTables[pid][page] : NULL;
+    if(shadow!=NULL&&(shadow->state & SHADOW_COW)){
+        if((shadow->slot!=-1&&slotRefs[shadow->slot]>1)||
+           ((shadow->state & SHADOW_RESIDENT)&&P3_frameTable[shadow->frame].refs>1)){
+            result = P3_COW_SHARED;
+        }else{
+            shadow->state &= ~SHADOW_COW;
+            result = P3_COW_PRIVATE;
+        }
+    }
+    rc = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapCowCopy --
+ *
+ *  Breaks the sharing of a copy-on-write page that its process wants to
+ *  write. The page gets its own swap slot, and if its frame is shared
+ *  the page is copied into frame, which the pager got for it. The pager
+ *  then maps the page writable.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_INVALID_PID:        pid is invalid
+ *   P3_OUT_OF_PAGES:       page is invalid, or the frames couldn't be
+ *                          mapped to copy the page, frame wasn't used
+ *   P3_INVALID_FRAME:      frame is invalid
+ *   P3_FRAME_NOT_MAPPED:   the page isn't resident any more, frame wasn't
+ *                          used
+ *   P3_OUT_OF_SWAP:        there is no swap space for the copy, frame
+ *                          wasn't used
+ *   P3_COW_PRIVATE:        the page's frame wasn't shared, it stays
+ *                          there and frame wasn't used
+ *   P1_SUCCESS:            the page is now in frame
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapCowCopy(PID pid, int page, int frame)
+{
+    int result = P1_SUCCESS;
+    int rc;
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(pid<0||pid>=P1_MAXPROC){
+        return P1_INVALID_PID;
+    }
+    if(page<0||page>=numPages){
+        return P3_OUT_OF_PAGES;
+    }
+    if(frame<0||frame>=numFrames){
+        return P3_INVALID_FRAME;
+    }
+    rc = P1_P(mutex);
+    Shadow *shadow = &ShadowGet(pid)[page];
+    while(shadow->state & SHADOW_BUSY){
+        WaitIO();
+        shadow = &shadowTables[pid][page];
+    }
+    if((shadow->state & SHADOW_COW)==0){
+        rc = P1_V(mutex);
+        return P3_COW_PRIVATE;
+    }
+    if((shadow->state & SHADOW_RESIDENT)==0){
+        rc = P1_V(mutex);
+        return P3_FRAME_NOT_MAPPED;
+    }
+    int old = shadow->frame;
+    if(P3_frameTable[old].refs>1){
+        // copy first, so nothing has changed if it can't be done
+        result = FrameCopy(old,frame);
+        if(result!=P1_SUCCESS){
+            rc = P1_V(mutex);
+            return result;
+        }
+    }
+    int slot = shadow->slot;
+    if(slot!=-1&&slotRefs[slot]>1){
+        shadow->slot = -1;
+        if(SlotAlloc(pid,page)==-1){
+            shadow->slot = slot;
+            rc = P1_V(mutex);
+            return P3_OUT_OF_SWAP;
+        }
+        SlotFree(slot);
+        shadow->state &= ~SHADOW_ON_SWAP;
+    }
+    shadow->state &= ~SHADOW_COW;
+    int access;
+    if(P3_frameTable[old].refs==1){
+        // the new slot doesn't have the page yet
+        rc = USLOSS_MmuGetAccess(old,&access);
+        rc = USLOSS_MmuSetAccess(old,access|USLOSS_MMU_DIRTY);
+        rc = P1_V(mutex);
+        return P3_COW_PRIVATE;
+    }
+    rc = FrameDrop(pid,page);
+    P3_frameTable[frame].pid = pid;
+    P3_frameTable[frame].page = page;
+    P3_frameTable[frame].busy = FALSE;
+    P3_frameTable[frame].refs = 1;
+    PffResident(pid,1);
+    shadow->frame = frame;
+    shadow->state |= SHADOW_RESIDENT;
+    PolicyForget(frame);
+    if(policy->insert!=NULL){
+        policy->insert(frame);
+    }
+    rc = USLOSS_MmuSetAccess(frame,USLOSS_MMU_DIRTY);
+    debug3("cow pid:%d page:%d frame:%d -> %d\n", pid,page,old,frame);
+    rc = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * FrameCopy --
+ *
+ *  Copies the page in frame from to frame to. If the caller's page
+ *  table has no room to map both frames at once the page goes through
+ *  poolBuffer one frame at a time. Call with mutex held.
+ *
+ * Results:
+ *   P3_OUT_OF_PAGES:   a frame couldn't be mapped
+ *   P1_SUCCESS:        success
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+FrameCopy(int from, int to)
+{
+    int rc;
+    int result;
+    void *src;
+    void *dst;
+    int pageSize = USLOSS_MmuPageSize();
+
+    result = P3FrameMap(from,&src);
+    if(result!=P1_SUCCESS){
+        return P3_OUT_OF_PAGES;
+    }
+    result = P3FrameMap(to,&dst);
+    if(result==P1_SUCCESS){
+        memcpy(dst,src,pageSize);
+        rc = P3FrameUnmap(to);
+        rc = P3FrameUnmap(from);
+        return P1_SUCCESS;
+    }
+    memcpy(poolBuffer,src,pageSize);
+    rc = P3FrameUnmap(from);
+    result = P3FrameMap(to,&dst);
+    if(result!=P1_SUCCESS){
+        return P3_OUT_OF_PAGES;
+    }
+    memcpy(dst,poolBuffer,pageSize);
+    rc = P3FrameUnmap(to);
+    return P1_SUCCESS;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapAdmit --
+ *
+ *  Called by the fault handler before a fault is given to the pagers.
+ *  Blocks while the process is suspended by load control.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_INVALID_PID:        pid is invalid
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapAdmit(PID pid)
+{
+    int result = P1_SUCCESS;
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(pid<0||pid>=P1_MAXPROC){
+        return P1_INVALID_PID;
+    }
+    result = P1_P(mutex);
+    while(load[pid].suspended==TRUE){
+        load[pid].waiting = TRUE;
+        result = P1_V(mutex);
+        result = P1_P(load[pid].wake);
+        result = P1_P(mutex);
+    }
+    result = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapSetLimit --
+ *
+ *  Sets the max # of frames a process can hold, 0 for no limit. A
+ *  process already over its new limit gives frames up as it faults.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_INVALID_PID:        pid is invalid
+ *   P3_INVALID_NUM_FRAMES: frames is negative
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapSetLimit(PID pid, int frames)
+{
+    int result = P1_SUCCESS;
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(pid<0||pid>=P1_MAXPROC){
+        return P1_INVALID_PID;
+    }
+    if(frames<0){
+        return P3_INVALID_NUM_FRAMES;
+    }
+    result = P1_P(mutex);
+    load[pid].limit = frames;
+    result = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapAtLimit --
+ *
+ *  Tells whether a process holds as many frames as its limit allows,
+ *  in which case a fault must replace one of its own pages.
+ *
+ * Results:
+ *   TRUE if the process is at its limit, FALSE otherwise
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapAtLimit(PID pid)
+{
+    int result = FALSE;
+    if(initialized==FALSE||pid<0||pid>=P1_MAXPROC){
+        return FALSE;
+    }
+    int rc = P1_P(mutex);
+    if(load[pid].limit>0&&load[pid].resident>=load[pid].limit){
+        result = TRUE;
+    }
+    rc = P1_V(mutex);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadControl --
+ *
+ *  Suspends the lowest-priority processes while the running processes'
+ *  working sets don't fit in memory, then resumes the highest-priority
+ *  suspended processes whose working sets fit in what's left. At least
+ *  one process is always left running. If sample is TRUE the reference
+ *  bits are sampled and the working sets are re-estimated first,
+ *  otherwise the last estimates are used. Suspended processes are
+ *  re-estimated too, so their working sets shrink while they wait.
+ *  Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+LoadControl(int sample)
+{
+    int total = 0;
+    int running = 0;
+    int rc;
+
+    if(sample==TRUE){
+        for(int frame=0;frame<numFrames;frame++){
+            int access;
+            if(FrameEvictable(frame)==FALSE){
+                continue;
+            }
+            rc = USLOSS_MmuGetAccess(frame,&access);
+            if(access&USLOSS_MMU_REF){
+                shadowTables[P3_frameTable[frame].pid][P3_frameTable[frame].page].lastRef = faultTime;
+            }
+        }
+    }
+    for(int pid=0;pid<P1_MAXPROC;pid++){
+        if(shadowTables[pid]==NULL){
+            continue;
+        }
+        if(sample==TRUE){
+            load[pid].ws = 0;
+            for(int page=0;page<numPages;page++){
+                int last = shadowTables[pid][page].lastRef;
+                if(last!=-1&&faultTime-last<=wsWindow){
+                    load[pid].ws++;
+                }
+            }
+        }
+        if(load[pid].suspended==TRUE){
+            continue;
+        }
+        total += load[pid].ws;
+        running++;
+    }
+    // thrashing, suspend the lowest-priority processes until the rest fit
+    while(total>numFrames&&running>1){
+        int victim = -1;
+        for(int pid=0;pid<P1_MAXPROC;pid++){
+            if(shadowTables[pid]==NULL||load[pid].suspended==TRUE){
+                continue;
+            }
+            // bigger numbers are lower priorities, break ties by freeing
+            // the most memory
+            if(victim==-1||LoadPriority(pid)>LoadPriority(victim)||
+               (LoadPriority(pid)==LoadPriority(victim)&&load[pid].ws>load[victim].ws)){
+                victim = pid;
+            }
+        }
+        debug3("suspend pid:%d ws:%d total:%d\n", victim,load[victim].ws,total);
+        load[victim].suspended = TRUE;
+        numSuspended++;
+        total -= load[victim].ws;
+        running--;
+        P3_vmStats.suspended++;
+        // the cleaner pages it out
+        CleanerKick();
+    }
+    // resume whoever fits, highest priority first
+    while(1){
+        int next = -1;
+        for(int pid=0;pid<P1_MAXPROC;pid++){
+            if(load[pid].suspended==FALSE){
+                continue;
+            }
+            if(next==-1||LoadPriority(pid)<LoadPriority(next)){
+                next = pid;
+            }
+        }
+        if(next==-1||(running>0&&total+load[next].ws>numFrames)){
+            break;
+        }
+        debug3("resume pid:%d ws:%d total:%d\n", next,load[next].ws,total);
+        LoadResume(next);
+        total += load[next].ws;
+        running++;
+    }
+    if(numSuspended>0){
+        ResumerKick();
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadResume --
+ *
+ *  Lets a suspended process run again. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+LoadResume(PID pid)
+{
+    int rc;
+    load[pid].suspended = FALSE;
+    numSuspended--;
+    if(load[pid].waiting==TRUE){
+        load[pid].waiting = FALSE;
+        rc = P1_V(load[pid].wake);
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PffFault --
+ *
+ *  Adjusts a process's resident-set target when it faults, by the CPU
+ *  time it has used since its previous fault. The first fault only
+ *  starts the clock. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PffFault(PID pid)
+{
+    P1_ProcInfo info;
+    int rc = P1_GetProcInfo(pid,&info);
+    if(rc!=P1_SUCCESS){
+        return;
+    }
+    if(load[pid].lastFault!=-1){
+        int interval = info.cpu-load[pid].lastFault;
+        int over = (load[pid].resident>load[pid].target);
+        if(interval<P3_PFF_FAST){
+            // faulting too often, give it the frame it faulted for
+            load[pid].target++;
+            if(load[pid].target>numFrames){
+                load[pid].target = numFrames;
+            }
+            if(load[pid].limit>0&&load[pid].target>load[pid].limit){
+                load[pid].target = load[pid].limit;
+            }
+        }else if(interval>P3_PFF_SLOW){
+            load[pid].target -= (load[pid].target>=8) ? load[pid].target/8 : 1;
+            if(load[pid].target<1){
+                load[pid].target = 1;
+            }
+        }
+        overTarget += (load[pid].resident>load[pid].target) - over;
+    }
+    load[pid].lastFault = info.cpu;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PffResident --
+ *
+ *  Changes a process's resident-set size by delta, keeping track of how
+ *  many processes are over their targets. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PffResident(PID pid, int delta)
+{
+    int over = (load[pid].resident>load[pid].target);
+    load[pid].resident += delta;
+    overTarget += (load[pid].resident>load[pid].target) - over;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * LoadPriority --
+ *
+ *  A process's priority doesn't change, so it is looked up once and
+ *  kept in load[pid] until the process quits. The load control loops
+ *  that compare priorities then don't call into phase 1.
+ *
+ * Results:
+ *   The process's priority, bigger numbers are lower priorities.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+LoadPriority(PID pid)
+{
+    if(load[pid].priority==-1){
+        P1_ProcInfo info;
+        int rc = P1_GetProcInfo(pid,&info);
+        if(rc!=P1_SUCCESS){
+            return 0;
+        }
+        load[pid].priority = info.priority;
+    }
+    return load[pid].priority;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SuspendedFrame --
+ *
+ * Results:
+ *   An evictable frame belonging to a suspended process, or -1 if there
+ *   isn't one. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SuspendedFrame(void)
+{
+    for(int frame=0;frame<numFrames;frame++){
+        if(FrameEvictable(frame)==TRUE&&load[P3_frameTable[frame].pid].suspended==TRUE){
+            return frame;
+        }
+    }
+    return -1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PolicyInit --
+ *
+ *  Sets up the replacement policy chosen by P3_vmPolicy. Call before
+ *  any frame is in use.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PolicyInit(void)
+{
+    policy = &policies[P3_vmPolicy];
+    nodes = malloc(sizeof(PolicyNode)*3*numFrames);
+    for(int i=0;i<NUM_LISTS;i++){
+        listHead[i] = -1;
+        listTail[i] = -1;
+        listSize[i] = 0;
+    }
+    for(int i=0;i<3*numFrames;i++){
+        nodes[i].list = -1;
+        nodes[i].pid = -1;
+        nodes[i].page = -1;
+        nodes[i].age = 0;
+        nodes[i].lastUse = 0;
+        nodes[i].hot = FALSE;
+        nodes[i].test = FALSE;
+        if(i>=numFrames){
+            ListAppend(LIST_FREE,i);
+        }
+    }
+    policyHand = -1;
+    vtime = 0;
+    wsTau = numFrames;
+    proHot = 0;
+    proColdTarget = 1;
+    arcTarget = 0;
+    debug3("replacement policy: %s\n", policy->name);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PolicyForget --
+ *
+ *  Tells the policy that a frame no longer holds its page.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PolicyForget(int frame)
+{
+    if(nodes[frame].list!=-1){
+        ListRemove(frame);
+    }
+    if(nodes[frame].hot==TRUE){
+        nodes[frame].hot = FALSE;
+        proHot--;
+    }
+    nodes[frame].test = FALSE;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * PolicyRelease --
+ *
+ *  Forgets a quitting process's resident pages and ghosts, so a new
+ *  process with the same pid doesn't inherit them. Call before the
+ *  process's frames are given up.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+PolicyRelease(PID pid)
+{
+    for(int i=0;i<numFrames;i++){
+        if(P3_frameTable[i].pid==pid){
+            PolicyForget(i);
+        }
+    }
+    for(int i=numFrames;i<3*numFrames;i++){
+        if(nodes[i].list!=LIST_FREE&&nodes[i].pid==pid){
+            ListRemove(i);
+            ListAppend(LIST_FREE,i);
+        }
+    }
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ListAppend --
+ *
+ *  Adds a node to the tail (most recent end) of a list.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ListAppend(int list, int node)
+{
+    nodes[node].list = list;
+    nodes[node].next = -1;
+    nodes[node].prev = listTail[list];
+    if(listTail[list]!=-1){
+        nodes[listTail[list]].next = node;
+    }else{
+        listHead[list] = node;
+    }
+    listTail[list] = node;
+    listSize[list]++;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ListRemove --
+ *
+ *  Removes a node from whatever list it is on.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ListRemove(int node)
+{
+    int list = nodes[node].list;
+    if(nodes[node].prev!=-1){
+        nodes[nodes[node].prev].next = nodes[node].next;
+    }else{
+        listHead[list] = nodes[node].next;
+    }
+    if(nodes[node].next!=-1){
+        nodes[nodes[node].next].prev = nodes[node].prev;
+    }else{
+        listTail[list] = nodes[node].prev;
+    }
+    nodes[node].list = -1;
+    listSize[list]--;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GhostAdd --
+ *
+ *  Remembers an evicted page on a ghost list. If there are no free ghost
+ *  nodes the oldest ghost on the list is reused.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+GhostAdd(int list, PID pid, int page)
+{
+    int ghost = listHead[LIST_FREE];
+    if(ghost==-1){
+        ghost = (listHead[list]!=-1) ? listHead[list] : listHead[LIST_B1+LIST_B2-list];
+    }
+    ListRemove(ghost);
+    nodes[ghost].pid = pid;
+    nodes[ghost].page = page;
+    ListAppend(list,ghost);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * GhostFind --
+ *
+ * Results:
+ *   The ghost node remembering a page, or -1 if there isn't one.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+GhostFind(PID pid, int page)
+{
+    for(int i=numFrames;i<3*numFrames;i++){
+        if(nodes[i].list!=LIST_FREE&&nodes[i].pid==pid&&nodes[i].page==page){
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * ClockSelect --
+ *
+ *  Second-chance clock. Referenced frames get their reference bit
+ *  cleared and are passed over. Two sweeps clear every reference bit, so
+ *  if they don't turn up a victim every frame is busy or free. Evicting
+ *  a dirty frame means a write, so after the first unreferenced dirty
+ *  frame the hand looks at up to P3_CLEAN_WINDOW more frames for a
+ *  clean one before settling for the dirty one.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+ClockSelect(void)
+{
+    int access;
+    int rc;
+    int dirty = -1;     // first unreferenced dirty frame
+    int window = 0;     // # frames looked at since
+    for(int i=0;i<2*numFrames;i++){
+        policyHand = (policyHand+1)%numFrames;
+        if(FrameVictim(policyHand)==FALSE){
+            continue;
+        }
+        rc = USLOSS_MmuGetAccess(policyHand,&access);
+        if((access&USLOSS_MMU_REF)==0){
+            if((access&USLOSS_MMU_DIRTY)==0){
+                return policyHand;
+            }
+            if(dirty==-1){
+                dirty = policyHand;
+                continue;
+            }
+        }else{
+            rc = USLOSS_MmuSetAccess(policyHand,access&USLOSS_MMU_DIRTY);
+        }
+        if(dirty!=-1&&++window>=P3_CLEAN_WINDOW){
+            break;
+        }
+    }
+    return dirty;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * WSClockSelect --
+ *
+ *  WSClock. A page that hasn't been referenced for wsTau replacements
+ *  has left its process's working set. The first clean page outside
+ *  its working set is the victim; dirty ones are left for the cleaner.
+ *  If there are none, the least recently used unreferenced page is.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+WSClockSelect(void)
 {
-    int pid;
-    int page;
-    int used;
-}Frame;
-static Frame *frameTable;
-
-typedef struct Data{
-    int pid;
-    int first;
-    int track;
-    int page;
-}Data;
+    int access;
+    int rc;
+    int oldest = -1;
+    vtime++;
+    for(int i=0;i<2*numFrames;i++){
+        policyHand = (policyHand+1)%numFrames;
+        if(FrameVictim(policyHand)==FALSE){
+            continue;
+        }
+        PolicyNode *node = &nodes[policyHand];
+        rc = USLOSS_MmuGetAccess(policyHand,&access);
+        if(access&USLOSS_MMU_REF){
+            rc = USLOSS_MmuSetAccess(policyHand,access&USLOSS_MMU_DIRTY);
+            node->lastUse = vtime;
+            continue;
+        }
+        if(vtime-node->lastUse>wsTau){
+            if((access&USLOSS_MMU_DIRTY)==0){
+                return policyHand;
+            }
+            CleanerKick();
+        }
+        if(oldest==-1||node->lastUse<nodes[oldest].lastUse){
+            oldest = policyHand;
+        }
+    }
+    return oldest;
+}
 
-static int sectorSize;
-static int trackSize;
-static int tracks;
-static int sectors;
-static int start;
-static Data *swapData;
+static void
+WSClockInsert(int frame)
+{
+    nodes[frame].lastUse = vtime;
+}
 
 /*
  *----------------------------------------------------------------------
  *
- * P3SwapInit --
- *
- *  Initializes the swap data structures.
+ * ClockProSelect --
  *
- * Results:
- *   P3_ALREADY_INITIALIZED:    this function has already been called
- *   P1_SUCCESS:                success
+ *  CLOCK-Pro, with a single hand doing the work of all three. Resident
+ *  pages are hot or cold, and the victim is always a cold page. A cold
+ *  page that is referenced during its test period becomes hot; when it
+ *  is evicted during its test period it is remembered on LIST_B1, and
+ *  faulting it back in before the ghost expires makes it hot and grows
+ *  the cold share of memory (ClockProInsert). Hot pages are demoted when
+ *  there are too many of them. As in ClockSelect, after the first dirty
+ *  cold page the hand looks at up to P3_CLEAN_WINDOW more frames for a
+ *  clean cold one.
  *
  *----------------------------------------------------------------------
  */
-int
-P3SwapInit(int pages, int frames)
+static int
+ClockProSelect(void)
 {
-    int result = P1_SUCCESS;
-
-    // initialize the swap data structures, e.g. the pool of free blocks
-    if(initialized==TRUE){
-        return P3_ALREADY_INITIALIZED;
+    int access;
+    int rc;
+    int fallback = -1;
+    int victim = -1;
+    int dirty = -1;     // first dirty cold frame
+    int window = 0;     // # frames looked at since
+    for(int i=0;i<3*numFrames;i++){
+        policyHand = (policyHand+1)%numFrames;
+        if(FrameVictim(policyHand)==FALSE){
+            continue;
+        }
+        if(dirty!=-1&&++window>P3_CLEAN_WINDOW){
+            break;
+        }
+        PolicyNode *node = &nodes[policyHand];
+        rc = USLOSS_MmuGetAccess(policyHand,&access);
+        if(node->hot==TRUE){
+            if(fallback==-1){
+                fallback = policyHand;
+            }
+            if(proHot>numFrames-proColdTarget){
+                if(access&USLOSS_MMU_REF){
+                    rc = USLOSS_MmuSetAccess(policyHand,access&USLOSS_MMU_DIRTY);
+                }else{
+                    node->hot = FALSE;
+                    node->test = FALSE;
+                    proHot--;
+                }
+            }
+            continue;
+        }
+        if(access&USLOSS_MMU_REF){
+            rc = USLOSS_MmuSetAccess(policyHand,access&USLOSS_MMU_DIRTY);
+            if(node->test==TRUE){
+                node->hot = TRUE;
+                proHot++;
+            }else{
+                node->test = TRUE;
+            }
+            continue;
+        }
+        if((access&USLOSS_MMU_DIRTY)==0){
+            victim = policyHand;
+            break;
+        }
+        if(dirty==-1){
+            dirty = policyHand;
+        }
     }
-    result = P1_SemCreate("Mutex",1,&mutex);
-    numFrames = frames;
-    numPages = pages;
-    frameTable=malloc(sizeof(Frame)*numFrames);
-    for(int i=0;i<numFrames;i++){
-        frameTable[i].pid=-1;
-        frameTable[i].page=-1;
-        frameTable[i].used=FALSE;
-    }
-    result = P2_DiskSize(P3_SWAP_DISK,&sectorSize,&trackSize,&tracks);
-    sectors = tracks*trackSize;
-    swapData = malloc(sizeof(Data)*sectors);
-    for(int i=0;i<sectors;i++){
-        swapData[i].pid=-1;
-        swapData[i].first=i/tracks;
-        swapData[i].track=i%tracks;
-        swapData[i].page= -1;
+    if(victim==-1){
+        victim = dirty;
+    }
+    if(victim==-1){
+        // all the cold pages are busy
+        return fallback;
+    }
+    if(nodes[victim].test==TRUE){
+        // the oldest ghost's test period is over, cold pages need less room
+        if(listSize[LIST_B1]>=numFrames){
+            int ghost = listHead[LIST_B1];
+            ListRemove(ghost);
+            ListAppend(LIST_FREE,ghost);
+            if(proColdTarget>1){
+                proColdTarget--;
+            }
+        }
+        GhostAdd(LIST_B1,P3_frameTable[victim].pid,P3_frameTable[victim].page);
+    }
+    return victim;
+}
+
+static void
+ClockProInsert(int frame)
+{
+    int ghost = GhostFind(P3_frameTable[frame].pid,P3_frameTable[frame].page);
+    if(ghost!=-1){
+        ListRemove(ghost);
+        ListAppend(LIST_FREE,ghost);
+        nodes[frame].hot = TRUE;
+        proHot++;
+        if(proColdTarget<numFrames-1){
+            proColdTarget++;
+        }
+    }else{
+        nodes[frame].test = TRUE;
     }
-    initialized=TRUE;
-    start = 0;
-    return result;
 }
+
 /*
  *----------------------------------------------------------------------
  *
- * P3SwapShutdown --
- *
- *  Cleans up the swap data structures.
+ * ArcSelect --
  *
- * Results:
- *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
- *   P1_SUCCESS:            success
+ *  ARC, in its clock form (CAR) since we only have reference bits. T1
+ *  holds pages seen once and T2 pages seen again; arcTarget is how big
+ *  T1 should be. The victim comes from the head of T1 if T1 is over its
+ *  target, otherwise from T2. A referenced head gets its bit cleared and
+ *  moves to the tail of T2. If the head is dirty, a clean page among the
+ *  next P3_CLEAN_WINDOW on the list is taken instead (ListClean). The
+ *  victim is remembered on B1 or B2.
  *
  *----------------------------------------------------------------------
  */
-int
-P3SwapShutdown(void)
+static int
+ArcSelect(void)
 {
-    if( initialized == FALSE){
-        return P3_NOT_INITIALIZED;
+    int access;
+    int rc;
+    for(int i=0;i<3*numFrames;i++){
+        int list = LIST_T2;
+        if(listSize[LIST_T1]>=(arcTarget>1 ? arcTarget : 1)||listSize[LIST_T2]==0){
+            list = LIST_T1;
+        }
+        int frame = listHead[list];
+        if(frame==-1){
+            return -1;
+        }
+        if(FrameVictim(frame)==FALSE){
+            ListRemove(frame);
+            ListAppend(list,frame);
+            continue;
+        }
+        rc = USLOSS_MmuGetAccess(frame,&access);
+        if(access&USLOSS_MMU_REF){
+            rc = USLOSS_MmuSetAccess(frame,access&USLOSS_MMU_DIRTY);
+            ListRemove(frame);
+            ListAppend(LIST_T2,frame);
+            continue;
+        }
+        if(access&USLOSS_MMU_DIRTY){
+            int clean = ListClean(frame);
+            if(clean!=-1){
+                frame = clean;
+            }
+        }
+        ListRemove(frame);
+        GhostAdd(list==LIST_T1 ? LIST_B1 : LIST_B2,P3_frameTable[frame].pid,P3_frameTable[frame].page);
+        return frame;
     }
-    int result = P1_SUCCESS;
-
-    // clean things up
-    free(swapData);
-    free(frameTable);
-    result = P1_SemFree(mutex);
-    initialized = FALSE;
-    return result;
+    return -1;
 }
 
 /*
  *----------------------------------------------------------------------
  *
- * P3SwapFreeAll --
+ * ListClean --
  *
- *  Frees all swap space used by a process
+ *  Looks at up to P3_CLEAN_WINDOW frames after node on its list for one
+ *  that is clean and unreferenced, which can be replaced without a
+ *  write. Nothing is moved and no reference bits are cleared.
  *
  * Results:
- *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
- *   P1_SUCCESS:            success
+ *   The frame, or -1 if there isn't one.
  *
  *----------------------------------------------------------------------
  */
-
-int
-P3SwapFreeAll(int pid)
+static int
+ListClean(int node)
 {
-    int result = P1_SUCCESS;
-
-    /*****************
+    int access;
+    int rc;
+    int frame = nodes[node].next;
+    for(int i=0;frame!=-1&&i<P3_CLEAN_WINDOW;i++){
+        if(FrameVictim(frame)==TRUE){
+            rc = USLOSS_MmuGetAccess(frame,&access);
+            if((access&(USLOSS_MMU_REF|USLOSS_MMU_DIRTY))==0){
+                return frame;
+            }
+        }
+        frame = nodes[frame].next;
+    }
+    return -1;
+}
 
-    P(mutex)
-    free all swap space used by the process
-    V(mutex)
+/*
+ *----------------------------------------------------------------------
+ *
+ * ArcInsert --
+ *
+ *  A page that isn't a ghost goes on T1. A ghost hit means we evicted
+ *  the page too soon: a hit in B1 grows T1's target, a hit in B2 shrinks
+ *  it, and the page goes on T2. The ghost lists are trimmed so that T1
+ *  and B1 together, and all four lists together, remember at most
+ *  numFrames and 2*numFrames pages.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+ArcInsert(int frame)
+{
+    int ghost = GhostFind(P3_frameTable[frame].pid,P3_frameTable[frame].page);
+    int b1 = listSize[LIST_B1];
+    int b2 = listSize[LIST_B2];
+    if(ghost==-1){
+        int trim = -1;
+        if(listSize[LIST_T1]+b1>=numFrames&&b1>0){
+            trim = listHead[LIST_B1];
+        }else if(listSize[LIST_T1]+listSize[LIST_T2]+b1+b2>=2*numFrames&&b2>0){
+            trim = listHead[LIST_B2];
+        }
+        if(trim!=-1){
+            ListRemove(trim);
+            ListAppend(LIST_FREE,trim);
+        }
+        ListAppend(LIST_T1,frame);
+        return;
+    }
+    if(nodes[ghost].list==LIST_B1){
+        arcTarget += (b2>b1) ? b2/b1 : 1;
+        if(arcTarget>numFrames){
+            arcTarget = numFrames;
+        }
+    }else{
+        arcTarget -= (b1>b2) ? b1/b2 : 1;
+        if(arcTarget<0){
+            arcTarget = 0;
+        }
+    }
+    ListRemove(ghost);
+    ListAppend(LIST_FREE,ghost);
+    ListAppend(LIST_T2,frame);
+}
 
-    *****************/
-    result = P1_P(mutex);
-    //free all swap space used by the process
-    for(int i=0;i<sectors;i++){
-        if(swapData[i].pid==pid){
-            result = P2_DiskWrite(P3_SWAP_DISK,swapData[i].track,swapData[i].first,1,NULL);
-            swapData[i].pid= -1;
-            swapData[i].page= -1;
+/*
+ *----------------------------------------------------------------------
+ *
+ * AgingSelect --
+ *
+ *  LRU approximation with aging counters. Every replacement shifts each
+ *  resident page's counter right and moves its reference bit into the
+ *  top bit, then evicts the page with the smallest counter. Ties go to
+ *  the first one after the hand, unless it is dirty and one of the next
+ *  P3_CLEAN_WINDOW frames is clean and just as old.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+AgingSelect(void)
+{
+    int access;
+    int rc;
+    int victim = -1;
+    for(int i=0;i<numFrames;i++){
+        if(P3_frameTable[i].pid==-1){
+            continue;
+        }
+        rc = USLOSS_MmuGetAccess(i,&access);
+        nodes[i].age >>= 1;
+        if(access&USLOSS_MMU_REF){
+            nodes[i].age |= 0x80;
+            rc = USLOSS_MmuSetAccess(i,access&USLOSS_MMU_DIRTY);
         }
     }
-    result = P1_V(mutex);
-    return result;
+    for(int i=0;i<numFrames;i++){
+        int frame = (policyHand+1+i)%numFrames;
+        if(FrameVictim(frame)==FALSE){
+            continue;
+        }
+        if(victim==-1||nodes[frame].age<nodes[victim].age){
+            victim = frame;
+        }
+    }
+    if(victim==-1){
+        return -1;
+    }
+    rc = USLOSS_MmuGetAccess(victim,&access);
+    for(int i=1;(access&USLOSS_MMU_DIRTY)&&i<=P3_CLEAN_WINDOW&&i<numFrames;i++){
+        int frame = (victim+i)%numFrames;
+        if(FrameVictim(frame)==FALSE||nodes[frame].age!=nodes[victim].age){
+            continue;
+        }
+        rc = USLOSS_MmuGetAccess(frame,&access);
+        if((access&USLOSS_MMU_DIRTY)==0){
+            victim = frame;
+        }
+    }
+    policyHand = victim;
+    return victim;
+}
+
+static void
+AgingInsert(int frame)
+{
+    // just loaded, so it has been used more recently than anything else
+    nodes[frame].age = 0x80;
 }
 
 /*
@@ -199,12 +3511,14 @@ P3SwapFreeAll(int pid)
  *
  * P3SwapOut --
  *
- * Uses the clock algorithm to select a frame to replace, writing the page that is in the frame out 
+ * Uses the replacement policy to select a frame to replace, writing the page that is in the frame out 
  * to swap if it is dirty. The page table of the page’s process is modified so that the page no 
  * longer maps to the frame. The frame that was selected is returned in *frame. 
  *
  * Results:
  *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P3_OUT_OF_PAGES:       the victim couldn't be mapped to write it out,
+ *                          *frame is -1
  *   P1_SUCCESS:            success
  *
  *----------------------------------------------------------------------
@@ -243,53 +3557,217 @@ P3SwapOut(int *frame)
     *frame = target
 
     *****************/
-    static int hand = -1;
+    result = SwapOut(-1, frame);
+    return result;
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapOutLocal --
+ *
+ *  Like P3SwapOut, but for a process at its resident-set limit: the
+ *  victim is one of the process's own pages. If none of them can be
+ *  replaced right now any page can.
+ *
+ * Results:
+ *   P3_NOT_INITIALIZED:    P3SwapInit has not been called
+ *   P1_INVALID_PID:        pid is invalid
+ *   P3_OUT_OF_PAGES:       see P3SwapOut
+ *   P1_SUCCESS:            success
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapOutLocal(PID pid, int *frame)
+{
+    if(initialized==FALSE){
+        return P3_NOT_INITIALIZED;
+    }
+    if(pid<0||pid>=P1_MAXPROC){
+        return P1_INVALID_PID;
+    }
+    return SwapOut(pid, frame);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SwapOut --
+ *
+ *  Does the work for P3SwapOut and P3SwapOutLocal. If local isn't -1
+ *  the victim is one of its pages if possible. If local is
+ *  SWAP_SUSPENDED the victim must be a suspended process's page, and
+ *  *frame is set to -1 if there isn't one rather than waiting.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SwapOut(PID local, int *frame)
+{
+    int result = P1_SUCCESS;
     result = P1_P(mutex);
     int target;
     int accessPtr;
+    USLOSS_PTE  *table = NULL;
+    // If the policy can't find a victim every frame is busy or free and
+    // we have to wait. Frames are freed and become replaceable without
+    // any I/O, so look at the free frames again each time we wake up.
     while(1){
-        hand = (hand+1)%numFrames;
-        if(frameTable[hand].used==FALSE){
-            result = USLOSS_MmuGetAccess(hand,&accessPtr);
-            if((accessPtr&1)!=USLOSS_MMU_REF){
-                target = hand;
-                break;
-            }else{
-                result = USLOSS_MmuSetAccess(hand,accessPtr&2);
+        target = -1;
+        if(local==SWAP_SUSPENDED){
+            target = SuspendedFrame();
+            if(target==-1){
+                result = P1_V(mutex);
+                *frame=-1;
+                return P1_SUCCESS;
             }
+            break;
         }
-    }
-    int index;
-    for(index=0;index<sectors;index++){
-        if(swapData[index].pid==frameTable[target].pid&&swapData[index].page==frameTable[target].page){
+        if(local!=-1){
+            localPid = local;
+            target = policy->select();
+            localPid = -1;
+        }
+        if(target==-1){
+            target = SuspendedFrame();
+        }
+        if(target==-1){
+            target = policy->select();
+        }
+        if(target==-1&&overTarget>0){
+            pffRelaxed = TRUE;
+            target = policy->select();
+            pffRelaxed = FALSE;
+        }
+        if(target!=-1){
             break;
         }
+        result = P3FrameTake(&target);
+        if(target!=-1){
+            result = P1_V(mutex);
+            *frame=target;
+            return P1_SUCCESS;
+        }
+        WaitIO();
     }
-    printf("swapOut pid:%d page:%d frame:%d\n", frameTable[target].pid,frameTable[target].page,target);
-    if((accessPtr&2)==USLOSS_MMU_DIRTY){    
-        void *addr; 
-        char buffer[USLOSS_MmuPageSize()];    
-        result = P3FrameMap(target,&addr);
-        // write page to its location on the swap disk
-        memcpy(&buffer,addr,USLOSS_MmuPageSize());
-        printf("write to disk\n");
-        result = P2_DiskWrite(P3_SWAP_DISK,swapData[index].track,swapData[index].first,USLOSS_MmuPageSize()/sectorSize,&buffer);
+    PolicyForget(target);
+    result = USLOSS_MmuGetAccess(target,&accessPtr);
+    PID pid = P3_frameTable[target].pid;
+    int page = P3_frameTable[target].page;
+    Shadow *shadow = &shadowTables[pid][page];
+    debug3("swapOut pid:%d page:%d frame:%d\n", pid,page,target);
 
-        result = P3FrameUnmap(target);
-        result = USLOSS_MmuSetAccess(target,accessPtr&1);
-    }
-    
     // update page table of process to indicate page is no longer in a frame
-    USLOSS_PTE  *table = NULL;
-    result = P3PageTableGet(frameTable[target].pid,&table);
-    (table+frameTable[target].page)->incore=0;
-    (table+frameTable[target].page)->frame=-1;
-    result = USLOSS_MmuSetPageTable(table); 
-    frameTable[target].used=TRUE;
+    result = P3PageTableGet(pid,&table);
+    (table+page)->incore=0;
+    result = USLOSS_MmuSetPageTable(table);
+    P3_frameTable[target].busy=TRUE;
+    shadow->state |= SHADOW_BUSY;
+    shadow->state &= ~SHADOW_RESIDENT;
+    shadow->frame = -1;
+    // a copy-on-write frame is taken away from everyone sharing it
+    for(P3Sharer *s=P3_frameTable[target].sharers;s!=NULL;s=s->next){
+        result = P3PageTableGet(s->pid,&table);
+        (table+s->page)->incore=0;
+        result = USLOSS_MmuSetPageTable(table);
+        shadowTables[s->pid][s->page].state |= SHADOW_BUSY;
+        shadowTables[s->pid][s->page].state &= ~SHADOW_RESIDENT;
+        shadowTables[s->pid][s->page].frame = -1;
+    }
+
+    if((accessPtr&USLOSS_MMU_DIRTY)==USLOSS_MMU_DIRTY){
+        result = USLOSS_MmuSetAccess(target,accessPtr&USLOSS_MMU_REF);
+        // only one page can own a compressed copy
+        if(P3_frameTable[target].refs>1||PoolStore(target,pid,page)==FALSE){
+            result = ClusterWrite(target,pid,page);
+            // PageWrite leaves the page dirty if it couldn't write it
+            result = USLOSS_MmuGetAccess(target,&accessPtr);
+            if((accessPtr&USLOSS_MMU_DIRTY)!=0&&
+               (shadowTables[pid][page].state&SHADOW_DROPPED)==0){
+                SwapOutUndo(target,pid,page);
+                result = P1_V(mutex);
+                *frame=-1;
+                return P3_OUT_OF_PAGES;
+            }
+            P3_vmStats.pageOuts++;
+        }
+        shadow = &shadowTables[pid][page];
+    }
+    P3_vmStats.replaced++;
+    shadow->state &= ~SHADOW_BUSY;
+    // the frame stays busy until the caller swaps a page into it
+    PffResident(pid,-1);
+    while(P3_frameTable[target].sharers!=NULL){
+        P3Sharer *s = P3_frameTable[target].sharers;
+        P3_frameTable[target].sharers = s->next;
+        shadowTables[s->pid][s->page].state &= ~SHADOW_BUSY;
+        PffResident(s->pid,-1);
+        free(s);
+    }
+    P3_frameTable[target].refs=0;
+    P3_frameTable[target].pid=-1;
+    P3_frameTable[target].page=-1;
+    CompleteIO();
+    // we only get here when there are no free frames
+    CleanerKick();
+    if(P3_MERGE_INTERVAL>0&&faultTime-mergeTime>=P3_MERGE_INTERVAL){
+        mergeTime = faultTime;
+        MergerKick();
+    }
     result = P1_V(mutex);
     *frame=target;
     return result;
 }
+/*
+ *----------------------------------------------------------------------
+ *
+ * SwapOutUndo --
+ *
+ *  Gives a victim whose page couldn't be written out back to the page
+ *  and its copy-on-write sharers, mapped as before. Call with mutex held.
+ *
+ *----------------------------------------------------------------------
+ */
+static void
+SwapOutUndo(int target, PID pid, int page)
+{
+    int rc;
+    USLOSS_PTE *table = NULL;
+    Shadow *shadow = &shadowTables[pid][page];
+
+    rc = P3PageTableGet(pid,&table);
+    (table+page)->incore=1;
+    rc = USLOSS_MmuSetPageTable(table);
+    shadow->state = (shadow->state & ~SHADOW_BUSY) | SHADOW_RESIDENT;
+    shadow->frame = target;
+    P3Sharer **link = &P3_frameTable[target].sharers;
+    while(*link!=NULL){
+        P3Sharer *s = *link;
+        shadow = &shadowTables[s->pid][s->page];
+        shadow->state &= ~SHADOW_BUSY;
+        if(shadow->state & SHADOW_DROPPED){
+            // the sharer quit during the write
+            *link = s->next;
+            P3_frameTable[target].refs--;
+            PffResident(s->pid,-1);
+            free(s);
+            continue;
+        }
+        rc = P3PageTableGet(s->pid,&table);
+        (table+s->page)->incore=1;
+        rc = USLOSS_MmuSetPageTable(table);
+        shadow->state |= SHADOW_RESIDENT;
+        shadow->frame = target;
+        link = &s->next;
+    }
+    P3_frameTable[target].busy=FALSE;
+    if(policy->insert!=NULL){
+        policy->insert(target);
+    }
+    CompleteIO();
+}
+
 /*
  *----------------------------------------------------------------------
  *
@@ -303,12 +3781,50 @@ P3SwapOut(int *frame)
  *   P1_INVALID_PAGE:        page is invalid         
  *   P1_INVALID_FRAME:       frame is invalid
  *   P1_OUT_OF_SWAP:         there is no more swap space
+ *   other:                  a compressed page couldn't be loaded into the
+ *                           frame, it stays in the pool
  *   P1_SUCCESS:             success
  *
  *----------------------------------------------------------------------
  */
 int
 P3SwapIn(int pid, int page, int frame)
+{
+    return SwapIn(pid, page, frame, FALSE);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * P3SwapInAhead --
+ *
+ *  Like P3SwapIn, but for a page the pager reads ahead of a sequential
+ *  fault. The process didn't fault on the page, so the read isn't
+ *  counted as a fault by the working-set estimate, the page fault
+ *  frequency, the merge interval or the page-in statistics.
+ *
+ * Results:
+ *   Same as P3SwapIn.
+ *
+ *----------------------------------------------------------------------
+ */
+int
+P3SwapInAhead(int pid, int page, int frame)
+{
+    return SwapIn(pid, page, frame, TRUE);
+}
+
+/*
+ *----------------------------------------------------------------------
+ *
+ * SwapIn --
+ *
+ *  Does the work for P3SwapIn and P3SwapInAhead.
+ *
+ *----------------------------------------------------------------------
+ */
+static int
+SwapIn(int pid, int page, int frame, int prefetch)
 {
     if(initialized==FALSE){
         return P3_NOT_INITIALIZED;
@@ -341,47 +3857,89 @@ P3SwapIn(int pid, int page, int frame)
     int result = P1_SUCCESS;
     int rc;
     rc = P1_P(mutex);
-    int onDisk = FALSE;
-    int index;
-    for(index=0;index<sectors;index++){
-        if(swapData[index].pid==pid&&swapData[index].page==page){
-            onDisk=TRUE;
-            break;
+    Shadow *shadow = &ShadowGet(pid)[page];
+    // the page may still be on its way out to the disk
+    while(shadow->state & SHADOW_BUSY){
+        WaitIO();
+        shadow = &shadowTables[pid][page];
+    }
+    int onDisk = (shadow->state & SHADOW_ON_SWAP) ? TRUE : FALSE;
+    int index = shadow->slot;
+    debug3("swapIn pid: %d page:%d frame:%d \n", pid,page,frame);
+    if(prefetch==FALSE){
+        faultTime++;
+        shadow->lastRef = faultTime;
+        if(faultTime%wsInterval==0){
+            LoadControl(TRUE);
         }
+        PffFault(pid);
     }
-    printf("swapIn pid: %d page:%d frame:%d \n", pid,page,frame);
-    if(onDisk==TRUE){
-        printf("read from disk\n");
+    P3_frameTable[frame].busy = TRUE;
+    if(shadow->state & SHADOW_IN_POOL){
+        // no I/O needed
+        result = PoolLoad(frame,pid,page);
+        shadow = &shadowTables[pid][page];
+    }else if(onDisk==TRUE){
+        if(poolSize>0){
+            P3_vmStats.poolMisses++;
+        }
         void *addr;
-        char buffer[USLOSS_MmuPageSize()]; 
+        int track = SlotTrack(index);
+        int first = SlotFirst(index);
+        Unit *unit = &units[SlotUnit(index)];
+        shadow->state |= SHADOW_BUSY;
+        unit->queue++;
+        rc = P1_V(mutex);
+        // read the page straight into the frame
         rc = P3FrameMap(frame,&addr);
-        rc = P2_DiskRead(P3_SWAP_DISK,swapData[index].track,swapData[index].first,USLOSS_MmuPageSize()/sectorSize, &buffer);
-        memcpy(addr,&buffer,USLOSS_MmuPageSize());
+        rc = P2_DiskRead(unit->disk,track,first,sectorsPerPage,addr);
         rc = P3FrameUnmap(frame);
-    }else{
-        for(index=0;index<sectors;index++){
-            if(swapData[index].pid==-1){
-                swapData[index].pid = pid;
-                swapData[index].page = page;
-                break;
-            }
+        // The slot stays valid until the process writes the page, so
+        // forget the read's own accesses. If the frame is still clean
+        // when it is evicted it is just dropped.
+        rc = USLOSS_MmuSetAccess(frame,0);
+        rc = P1_P(mutex);
+        unit->queue--;
+        shadow = &shadowTables[pid][page];
+        shadow->state &= ~SHADOW_BUSY;
+        if(prefetch==FALSE){
+            // reads ahead are counted by the pager as prefetched
+            P3_vmStats.pageIns++;
         }
-        if(index == sectors){
+        CompleteIO();
+    }else if(index != -1){
+        // has swap space but was never written out
+        result = P3_EMPTY_PAGE;
+    }else{
+        index = SlotAlloc(pid, page);
+        if(index == -1){
             result =  P3_OUT_OF_SWAP;
         }else{
             result = P3_EMPTY_PAGE;
         }
     }
-    USLOSS_PTE  *table = NULL;
-    rc = P3PageTableGet(pid,&table);
-    (table+page)->incore=1;
-    (table+page)->write=1;
-    (table+page)->read=1;
-    (table+page)->frame=frame;
-    rc = USLOSS_MmuSetPageTable(table);
-    frameTable[frame].pid = pid;
-    frameTable[frame].page = page;
-    frameTable[frame].used= FALSE;
+    if(result != P1_SUCCESS && result != P3_EMPTY_PAGE){
+        // the pager returns the frame to the free pool
+        P3_frameTable[frame].pid = -1;
+        P3_frameTable[frame].page = -1;
+        P3_frameTable[frame].busy = FALSE;
+        rc = P1_V(mutex);
+        return result;
+    }
+    // The pager maps the page once the frame holds the right contents.
+    // Until then the clock skips the frame since the PTE doesn't point at it.
+    P3_frameTable[frame].pid = pid;
+    P3_frameTable[frame].page = page;
+    P3_frameTable[frame].busy= FALSE;
+    P3_frameTable[frame].refs = 1;
+    PffResident(pid,1);
+    shadow->frame = frame;
+    shadow->state |= SHADOW_RESIDENT;
+    PolicyForget(frame);
+    if(policy->insert!=NULL){
+        policy->insert(frame);
+    }
+    CleanerKick();
     rc = P1_V(mutex);
     return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,172 @@
+/*
+ * test_clone.c
+ *
+ *  Tests P3_VmClone and copy-on-write faults. P4_Startup has no page table since it was
+ *  created before the VM system, so the test runs in a "Parent" process. The parent fills
+ *  each of its pages with a letter, then clones its address space into a child that hasn't touched any pages yet.
+ *  The child checks that it sees the parent's pages, then writes its own letter into every
+ *  page and checks it. Once the child is done the parent checks that its pages didn't change.
+ *
+ *  There are exactly as many frames as pages, so the whole parent region is resident when it
+ *  is cloned and every copy the child makes has to replace a page.
+ *
+ *  P3_VmClone can only be called in kernel mode, the test calls it through the system
+ *  call in vmcall.h.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+#include "vmcall.h"
+
+#define PAGES 4         // # of pages
+#define FRAMES PAGES    // # of frames
+#define PAGERS 2        // # of pagers
+
+static char *vmRegion;
+static int  pageSize;
+static int  go;         // the child waits here until it has been cloned
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static int
+Child(void *arg)
+{
+    int     j;
+    char    *page;
+    int     pid;
+    int     rc;
+
+    Sys_GetPID(&pid);
+    Debug("Child (%d) starting.\n", pid);
+    rc = Sys_SemP(go);
+    assert(rc == P1_SUCCESS);
+
+    // The child starts with the parent's pages.
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child reading parent's page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'A' + j);
+        }
+    }
+    // Writing them gives the child its own copies.
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'a' + j;
+        }
+    }
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child reading from page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'a' + j);
+        }
+    }
+    Debug("Child done.\n");
+    return 0;
+}
+
+static int
+Parent(void *arg)
+{
+    int     j;
+    int     rc;
+    int     me;
+    int     pid;
+    int     status;
+    char    *page;
+
+    Sys_GetPID(&me);
+    Debug("Parent (%d) starting.\n", me);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Parent writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A' + j;
+        }
+    }
+    rc = Sys_SemCreate("go", 0, &go);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Spawn("Child", Child, NULL, USLOSS_MIN_STACK * 4, 2, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_VmClone(me, pid);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_SemV(go);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Debug("Child terminated\n");
+
+    // The child's writes didn't change the parent's pages.
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Parent reading from page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'A' + j);
+        }
+    }
+    Debug("Parent done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    VmCallInit();
+
+    pageSize = USLOSS_MmuPageSize();
+    rc = Sys_Spawn("Parent", Parent, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,150 @@
+/*
+ * test_limit.c
+ *
+ *  Tests P3_VmSetLimit. There are as many frames as pages, so without a limit the child
+ *  could keep all of its pages resident. The parent limits the child to LIMIT frames
+ *  before it starts. The child writes every page, counting the frames it holds after
+ *  each write, then reads every page back a few times. It must never hold more than
+ *  LIMIT frames, and its pages must keep their contents while they are replaced.
+ *
+ *  P3_VmSetLimit can only be called in kernel mode, the test calls it through the
+ *  system call in vmcall.h.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+#include "vmcall.h"
+
+#define PAGES 8         // # of pages
+#define FRAMES PAGES    // # of frames
+#define PAGERS 2        // # of pagers
+#define LIMIT 3         // # of frames the child may use
+#define ITERATIONS 3
+
+static char *vmRegion;
+static int  pageSize;
+static int  go;         // the child waits here until it has a limit
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+/*
+ * Returns the number of frames that hold one of pid's pages.
+ */
+static int
+Resident(int pid)
+{
+    int count = 0;
+
+    for (int i = 0; i < FRAMES; i++) {
+        if (P3_frameTable[i].pid == pid) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static int
+Child(void *arg)
+{
+    int     i;
+    int     j;
+    char    *page;
+    int     pid;
+    int     rc;
+
+    Sys_GetPID(&pid);
+    Debug("Child (%d) starting.\n", pid);
+    rc = Sys_SemP(go);
+    assert(rc == P1_SUCCESS);
+
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A' + j;
+        }
+        Debug("Child has %d frames\n", Resident(pid));
+        TEST(Resident(pid) <= LIMIT, TRUE);
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child reading from page %d @ %p\n", j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], 'A' + j);
+            }
+            TEST(Resident(pid) <= LIMIT, TRUE);
+        }
+    }
+    Debug("Child done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    VmCallInit();
+
+    pageSize = USLOSS_MmuPageSize();
+    rc = Sys_SemCreate("go", 0, &go);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Spawn("Child", Child, NULL, USLOSS_MIN_STACK * 4, 2, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_VmSetLimit(pid, -1);
+    TEST(rc, P3_INVALID_NUM_FRAMES);
+    rc = Sys_VmSetLimit(pid, LIMIT);
+    TEST(rc, P1_SUCCESS);
+    rc = Sys_SemV(go);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Debug("Child terminated\n");
+    TEST(P3_vmStats.replaced > 0, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,119 @@
+/*
+ * test_load.c
+ *
+ *  Tests load control. Three children each write a different letter into every page and
+ *  then read their pages back a few times. Each child's working set is all of its pages
+ *  and there are only half as many frames as pages, so together they thrash and load
+ *  control must suspend some of them. The suspended children's frames are paged out by
+ *  the cleaner and they are resumed when the others are done, so every child must finish
+ *  with its pages intact and nobody may be left suspended.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8             // # of pages
+#define FRAMES (PAGES / 2)  // # of frames
+#define PAGERS 2            // # of pagers
+#define CHILDREN 3
+#define ITERATIONS 3
+
+static char *vmRegion;
+static int  pageSize;
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static int
+Child(void *arg)
+{
+    char    c = *((char *) arg);
+    int     i;
+    int     j;
+    char    *page;
+
+    Debug("Child %c starting.\n", c);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child %c writing to page %d @ %p\n", c, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = c + j;
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child %c reading from page %d @ %p\n", c, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], c + j);
+            }
+        }
+    }
+    Debug("Child %c done.\n", c);
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    static char names[CHILDREN] = {'A', 'a', '0'};
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+
+    for (i = 0; i < CHILDREN; i++) {
+        rc = Sys_Spawn("Child", Child, &names[i], USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+    }
+    for (i = 0; i < CHILDREN; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    Debug("suspended %d\n", P3_vmStats.suspended);
+    TEST(P3_vmStats.suspended > 0, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,135 @@
+/*
+ * test_merge.c
+ *
+ *  Tests same-page merging. The child fills every page with the same byte. There are
+ *  twice as many pages as frames, so reading its pages over and over keeps it faulting
+ *  and the merger gets to run. The child keeps reading until some pages have been merged
+ *  onto a shared copy-on-write frame. It then writes its own letter into every other
+ *  page, which breaks the sharing, and reads all of its pages back a few times: the pages
+ *  it wrote must hold its letters and the others must still hold the original byte, so
+ *  a write to a merged page must not show up in the pages it was merged with.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 16            // # of pages
+#define FRAMES (PAGES / 2)  // # of frames
+#define PAGERS 2            // # of pagers
+#define ROUNDS 200          // most passes to wait for a merge
+#define ITERATIONS 3
+#define FILL 'x'            // what every page starts out with
+
+static char *vmRegion;
+static int  pageSize;
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static void
+Check(int j, char c)
+{
+    char    *page = vmRegion + j * pageSize;
+
+    Debug("Child reading from page %d @ %p\n", j, page);
+    for (int k = 0; k < pageSize; k++) {
+        TEST(page[k], c);
+    }
+}
+
+static int
+Child(void *arg)
+{
+    int     i;
+    int     j;
+    char    *page;
+
+    Debug("Child starting.\n");
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child filling page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = FILL;
+        }
+    }
+    for (i = 0; i < ROUNDS && P3_vmStats.merged == 0; i++) {
+        for (j = 0; j < PAGES; j++) {
+            Check(j, FILL);
+        }
+    }
+    Debug("merged %d after %d rounds\n", P3_vmStats.merged, i);
+    TEST(P3_vmStats.merged > 0, TRUE);
+
+    // break the sharing
+    for (j = 0; j < PAGES; j += 2) {
+        page = vmRegion + j * pageSize;
+        Debug("Child writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A' + j;
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            Check(j, (j % 2 == 0) ? 'A' + j : FILL);
+        }
+    }
+    Debug("Child done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+
+    rc = Sys_Spawn("Child", Child, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,168 @@
+/*
+ * test_pff.c
+ *
+ *  Tests page-fault-frequency frame allocation. "Slow" touches all of its pages, running
+ *  for a long time between faults, so its resident-set target shrinks on every fault even
+ *  though all of its pages fit in memory. It then waits with all its pages resident, and
+ *  "Fast" touches most of its pages as quickly as it can, so its target stays at the
+ *  whole of memory. Slow is over its target and Fast isn't, so Fast's faults must take
+ *  Slow's frames and never Fast's own: after its first pass over its pages Fast must not
+ *  fault again. Slow's pages must still be correct when it comes back.
+ *
+ *  The interval between faults is measured in each process's own CPU time, so Fast's
+ *  faults must not change Slow's target and Slow's long pauses must not shrink Fast's.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8             // # of pages
+#define FRAMES PAGES        // # of frames
+#define PAGERS 2            // # of pagers
+#define FAST_PAGES (FRAMES - 1) // # of pages Fast uses
+#define ITERATIONS 3
+#define SPIN 20000000       // enough CPU time between Slow's faults to exceed P3_PFF_SLOW
+
+static char *vmRegion;
+static int  pageSize;
+static int  touched;        // Slow has touched all of its pages
+static int  resume;         // Slow waits here while Fast runs
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static int
+Slow(void *arg)
+{
+    int     j;
+    int     rc;
+    char    *page;
+    volatile int spin;
+
+    Debug("Slow starting.\n");
+    for (j = 0; j < PAGES; j++) {
+        for (spin = 0; spin < SPIN; spin++) {
+        }
+        page = vmRegion + j * pageSize;
+        Debug("Slow writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A' + j;
+        }
+    }
+    rc = Sys_SemV(touched);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemP(resume);
+    assert(rc == P1_SUCCESS);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Slow reading from page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'A' + j);
+        }
+    }
+    Debug("Slow done.\n");
+    return 0;
+}
+
+static int
+Fast(void *arg)
+{
+    int     i;
+    int     j;
+    int     faults;
+    char    *page;
+
+    Debug("Fast starting.\n");
+    for (i = 0; i < ITERATIONS; i++) {
+        faults = P3_vmStats.faults;
+        for (j = 0; j < FAST_PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Fast writing to page %d @ %p\n", j, page);
+            for (int k = 0; k < pageSize; k++) {
+                page[k] = 'a' + j;
+            }
+        }
+        if (i > 0) {
+            // Fast's pages are kept, Slow gave up the frames
+            TEST(P3_vmStats.faults, faults);
+        }
+    }
+    for (j = 0; j < FAST_PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'a' + j);
+        }
+    }
+    Debug("Fast done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+    rc = Sys_SemCreate("touched", 0, &touched);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemCreate("resume", 0, &resume);
+    assert(rc == P1_SUCCESS);
+
+    rc = Sys_Spawn("Slow", Slow, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemP(touched);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Spawn("Fast", Fast, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    rc = Sys_SemV(resume);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * test_policies.c
+ *
+ *  Runs the same workload under each page replacement policy. There are more pages than
+ *  frames, so every policy has to pick victims. For each policy the test sets P3_vmPolicy,
+ *  initializes the VM system and runs a child that writes a different letter into each
+ *  page and reads the pages back a few times in order and then in reverse. Then it shuts
+ *  the VM system down. Every page must keep its contents, and every policy must have
+ *  replaced pages.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8         // # of pages
+#define FRAMES 3        // # of frames
+#define PAGERS 2        // # of pagers
+#define ITERATIONS 3
+
+static char *vmRegion;
+static int  pageSize;
+static int  policy;     // the policy being tested
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static void
+Check(int j, char c)
+{
+    char    *page = vmRegion + j * pageSize;
+
+    Debug("Child reading from page %d @ %p\n", j, page);
+    for (int k = 0; k < pageSize; k++) {
+        TEST(page[k], c);
+    }
+}
+
+static int
+Child(void *arg)
+{
+    int     i;
+    int     j;
+    char    *page;
+
+    Debug("Child starting, policy %d.\n", policy);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = 'A' + policy + j;
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            Check(j, 'A' + policy + j);
+        }
+        for (j = PAGES - 1; j >= 0; j--) {
+            Check(j, 'A' + policy + j);
+        }
+    }
+    Debug("Child done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    for (policy = 0; policy < P3_NUM_POLICIES; policy++) {
+        Debug("P4_Startup using policy %d\n", policy);
+        P3_vmPolicy = policy;
+        rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+        TEST(rc, P1_SUCCESS);
+
+        pageSize = USLOSS_MmuPageSize();
+        rc = Sys_Spawn("Child", Child, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+        TEST(P3_vmStats.replaced > 0, TRUE);
+        Sys_VmShutdown();
+    }
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,124 @@
+/*
+ * test_pool.c
+ *
+ *  Tests the compressed swap cache. There are more pages than frames, and every page
+ *  holds a pattern of short runs that compresses to about a quarter of a page, so
+ *  evicted pages go into the pool. The pool only has room for a few of them, so it
+ *  fills up and the cleaner has to write the oldest ones back to swap. A child writes
+ *  every page, then reads every page back a few times and checks its contents.
+ *
+ *  At the end some pages must have been stored in and loaded from the pool, and the
+ *  pool must have stored them in less space than they take uncompressed.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 16        // # of pages
+#define FRAMES 4        // # of frames
+#define PAGERS 2        // # of pagers
+#define ITERATIONS 3
+
+#define RUN 8           // length of the runs in each page
+
+static char *vmRegion;
+static int  pageSize;
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static char
+Pattern(int page, int offset)
+{
+    return (char) (page * 31 + offset / RUN);
+}
+
+static int
+Child(void *arg)
+{
+    int     i;
+    int     j;
+    char    *page;
+
+    Debug("Child starting.\n");
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child writing to page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = Pattern(j, k);
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child reading from page %d @ %p\n", j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], Pattern(j, k));
+            }
+        }
+    }
+    Debug("Child done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+
+    pageSize = USLOSS_MmuPageSize();
+    rc = Sys_Spawn("Child", Child, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Debug("stores %d bytes %d hits %d misses %d\n", P3_vmStats.poolStores,
+          P3_vmStats.poolBytes, P3_vmStats.poolHits, P3_vmStats.poolMisses);
+    TEST(P3_vmStats.poolStores > 0, TRUE);
+    TEST(P3_vmStats.poolHits > 0, TRUE);
+    TEST(P3_vmStats.poolBytes < P3_vmStats.poolStores * pageSize, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
@@ -0,0 +1,149 @@
+/*
+ * test_readahead.c
+ *
+ *  Tests readahead. Child "A" writes every page and waits. Child "B" then writes every
+ *  page too, and there are only as many frames as pages, so all of A's pages are
+ *  replaced and end up on swap. When B quits all of the frames are free again. A then
+ *  reads its pages in order. That is a sequential run of faults on pages that are on
+ *  swap, with free frames to read into, so the pager must read pages ahead of A, and
+ *  since A goes on to read them those prefetched pages must be counted as hits. A's pages
+ *  must all hold what it wrote.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 16        // # of pages
+#define FRAMES PAGES    // # of frames
+#define PAGERS 2        // # of pagers
+
+static char *vmRegion;
+static int  pageSize;
+static int  written;    // A has written its pages
+static int  resume;     // A waits here while B runs
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static void
+Write(char c)
+{
+    char    *page;
+
+    for (int j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child %c writing to page %d @ %p\n", c, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = c + j;
+        }
+    }
+}
+
+static int
+ChildA(void *arg)
+{
+    int     rc;
+    char    *page;
+
+    Debug("Child A starting.\n");
+    Write('A');
+    rc = Sys_SemV(written);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemP(resume);
+    assert(rc == P1_SUCCESS);
+    for (int j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child A reading from page %d @ %p\n", j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], 'A' + j);
+        }
+    }
+    Debug("Child A done.\n");
+    return 0;
+}
+
+static int
+ChildB(void *arg)
+{
+    Debug("Child B starting.\n");
+    Write('a');
+    Debug("Child B done.\n");
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    int     rc;
+    int     pid;
+    int     status;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+    rc = Sys_SemCreate("written", 0, &written);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemCreate("resume", 0, &resume);
+    assert(rc == P1_SUCCESS);
+
+    rc = Sys_Spawn("A", ChildA, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemP(written);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Spawn("B", ChildB, NULL, USLOSS_MIN_STACK * 4, 3, &pid);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    // none of the faults so far were sequential faults on swapped pages
+    TEST(P3_vmStats.prefetched, 0);
+
+    rc = Sys_SemV(resume);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Debug("prefetched %d hits %d misses %d\n", P3_vmStats.prefetched,
+          P3_vmStats.prefetchHits, P3_vmStats.prefetchMisses);
+    TEST(P3_vmStats.prefetched > 0, TRUE);
+    TEST(P3_vmStats.prefetchHits > 0, TRUE);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
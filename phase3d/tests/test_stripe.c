@@ -0,0 +1,157 @@
+/*
+ * test_stripe.c
+ *
+ *  Tests swap striping. Swap is spread over the disks in P3_SWAP_DISKS, so it must have
+ *  as many blocks as all of those disks hold together. Then several children page at
+ *  the same time, each with more pages than the frames can hold, so their pages are
+ *  written out to and read back from the swap units side by side. The pages are filled
+ *  with bytes that don't repeat, so they don't fit in the compressed pool and have to go
+ *  to the disks. Every page must keep its contents, and all of the blocks must be free
+ *  again once the children quit.
+ *
+ *  P3_SWAP_DISKS is fixed when phase 3d is compiled. The test checks whatever set of
+ *  disks it was built with; build phase 3d and the test with -DP3_SWAP_DISKS="{0,1}" to
+ *  stripe across both disks.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8         // # of pages
+#define FRAMES 4        // # of frames
+#define PAGERS 2        // # of pagers
+#define ITERATIONS 3
+
+static char *vmRegion;
+static int  pageSize;
+static char *names[] = {"A","B","C"};
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+/*
+ * Returns the number of pages that fit on a swap disk.
+ */
+static int
+DiskBlocks(int unit)
+{
+    int     rc;
+    int     sector;
+    int     track;
+    int     tracks;
+    int     sectors = USLOSS_MmuPageSize();
+
+    rc = Sys_DiskSize(unit, &sector, &track, &tracks);
+    assert(rc == P1_SUCCESS);
+    sectors /= sector;
+    if (track >= sectors) {
+        // pages don't cross tracks
+        return tracks * (track / sectors);
+    }
+    return (tracks * track) / sectors;
+}
+
+static int
+Child(void *arg)
+{
+    char    c = *((char *) arg);
+    int     i;
+    int     j;
+    char    *page;
+
+    Debug("Child %c starting.\n", c);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child %c writing to page %d @ %p\n", c, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = c + j + k;
+        }
+    }
+    for (i = 0; i < ITERATIONS; i++) {
+        for (j = 0; j < PAGES; j++) {
+            page = vmRegion + j * pageSize;
+            Debug("Child %c reading from page %d @ %p\n", c, j, page);
+            for (int k = 0; k < pageSize; k++) {
+                TEST(page[k], (char) (c + j + k));
+            }
+        }
+    }
+    Debug("Child %c done.\n", c);
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    static int disks[] = P3_SWAP_DISKS;
+    int     numDisks = sizeof(disks) / sizeof(disks[0]);
+    int     numChildren = sizeof(names) / sizeof(char *);
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+    int     blocks = 0;
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+
+    // swap is all of the disks put together
+    for (i = 0; i < numDisks; i++) {
+        blocks += DiskBlocks(disks[i]);
+    }
+    Debug("%d disks, %d blocks\n", numDisks, blocks);
+    TEST(P3_vmStats.blocks, blocks);
+    TEST(P3_vmStats.freeBlocks, blocks);
+
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Spawn(names[i], Child, names[i], USLOSS_MIN_STACK * 4, 3, &pid);
+        assert(rc == P1_SUCCESS);
+    }
+    for (i = 0; i < numChildren; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    TEST(P3_vmStats.pageIns > 0, TRUE);
+    TEST(P3_vmStats.freeBlocks, blocks);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
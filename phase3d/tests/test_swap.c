@@ -0,0 +1,193 @@
+/*
+ * test_swap.c
+ *
+ *  Tests swap space allocation and the fragmentation statistics.
+ *
+ *  First a child touches one page and checks that it used exactly one block of swap, then
+ *  touches the rest of its pages and checks that it used one block per page. When it quits
+ *  all of its blocks must be free again. A second child then does the same thing, so the
+ *  freed blocks have to be reused, and checks that its pages hold what it wrote rather
+ *  than what the first child left behind. Swap has no holes yet, so the largest free run
+ *  must be all of the free blocks.
+ *
+ *  Then three children each touch all of their pages and wait. The middle one quits,
+ *  leaving a hole between the other two, so swap is fragmented: the largest free run must
+ *  be smaller than the number of free blocks at that point.
+ *
+ */
+#include <usyscall.h>
+#include <libuser.h>
+#include <assert.h>
+#include <usloss.h>
+#include <stdlib.h>
+#include <phase3.h>
+#include <stdarg.h>
+#include <unistd.h>
+
+#include "tester.h"
+#include "phase3Int.h"
+
+#define PAGES 8         // # of pages
+#define FRAMES 2        // # of frames
+#define PAGERS 2        // # of pagers
+#define CHILDREN 2
+#define HOLDERS 3       // # of children that hold their blocks
+
+static char *vmRegion;
+static int  pageSize;
+static int  blocks;     // free blocks before any child runs
+static int  touched;    // a holder has touched all of its pages
+static int  hold[HOLDERS];  // holders wait here until they may quit
+
+static int passed = FALSE;
+
+#ifdef DEBUG
+int debugging = 1;
+#else
+int debugging = 0;
+#endif /* DEBUG */
+
+static void
+Debug(char *fmt, ...)
+{
+    va_list ap;
+
+    if (debugging) {
+        va_start(ap, fmt);
+        USLOSS_VConsole(fmt, ap);
+    }
+}
+
+static void
+Touch(char c)
+{
+    char    *page;
+
+    for (int j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child %c writing to page %d @ %p\n", c, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            page[k] = c + j;
+        }
+    }
+}
+
+static int
+Child(void *arg)
+{
+    char    c = *((char *) arg);
+    int     j;
+    char    *page;
+
+    Debug("Child %c starting.\n", c);
+    // touching a page takes one block, not a whole extent
+    page = vmRegion;
+    page[0] = c;
+    TEST(P3_vmStats.freeBlocks, blocks - 1);
+
+    Touch(c);
+    TEST(P3_vmStats.freeBlocks, blocks - PAGES);
+    for (j = 0; j < PAGES; j++) {
+        page = vmRegion + j * pageSize;
+        Debug("Child %c reading from page %d @ %p\n", c, j, page);
+        for (int k = 0; k < pageSize; k++) {
+            TEST(page[k], c + j);
+        }
+    }
+    Debug("Child %c done.\n", c);
+    return 0;
+}
+
+static int
+Holder(void *arg)
+{
+    int     i = (int) arg;
+    int     rc;
+
+    Debug("Holder %d starting.\n", i);
+    Touch('0' + i);
+    rc = Sys_SemV(touched);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemP(hold[i]);
+    assert(rc == P1_SUCCESS);
+    Debug("Holder %d done.\n", i);
+    return 0;
+}
+
+int
+P4_Startup(void *arg)
+{
+    static char names[CHILDREN] = {'A', 'a'};
+    int     i;
+    int     rc;
+    int     pid;
+    int     status;
+    char    name[P1_MAXNAME+1];
+
+    Debug("P4_Startup starting.\n");
+    rc = Sys_VmInit(PAGES, PAGES, FRAMES, PAGERS, (void **) &vmRegion);
+    TEST(rc, P1_SUCCESS);
+    pageSize = USLOSS_MmuPageSize();
+    TEST(P3_vmStats.freeBlocks, P3_vmStats.blocks);
+    blocks = P3_vmStats.freeBlocks;
+    TEST(blocks > HOLDERS * PAGES, TRUE);
+
+    for (i = 0; i < CHILDREN; i++) {
+        rc = Sys_Spawn("Child", Child, &names[i], USLOSS_MIN_STACK * 4, 2, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+        // all of the child's blocks are free again
+        TEST(P3_vmStats.freeBlocks, blocks);
+    }
+    TEST(P3_vmStats.largestFree, P3_vmStats.fragFree);
+
+    // the holders touch their pages one after the other, so their blocks are in order
+    rc = Sys_SemCreate("touched", 0, &touched);
+    assert(rc == P1_SUCCESS);
+    for (i = 0; i < HOLDERS; i++) {
+        snprintf(name, sizeof(name), "hold%d", i);
+        rc = Sys_SemCreate(name, 0, &hold[i]);
+        assert(rc == P1_SUCCESS);
+        snprintf(name, sizeof(name), "Holder %d", i);
+        rc = Sys_Spawn(name, Holder, (void *) i, USLOSS_MIN_STACK * 4, 2, &pid);
+        assert(rc == P1_SUCCESS);
+        rc = Sys_SemP(touched);
+        assert(rc == P1_SUCCESS);
+    }
+    TEST(P3_vmStats.freeBlocks, blocks - HOLDERS * PAGES);
+    // the middle one quits and leaves a hole
+    rc = Sys_SemV(hold[1]);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_Wait(&pid, &status);
+    assert(rc == P1_SUCCESS);
+    TEST(status, 0);
+    Debug("largestFree %d fragFree %d\n", P3_vmStats.largestFree, P3_vmStats.fragFree);
+    TEST(P3_vmStats.fragFree, blocks - (HOLDERS - 1) * PAGES);
+    TEST(P3_vmStats.largestFree < P3_vmStats.fragFree, TRUE);
+
+    rc = Sys_SemV(hold[0]);
+    assert(rc == P1_SUCCESS);
+    rc = Sys_SemV(hold[2]);
+    assert(rc == P1_SUCCESS);
+    for (i = 0; i < HOLDERS - 1; i++) {
+        rc = Sys_Wait(&pid, &status);
+        assert(rc == P1_SUCCESS);
+        TEST(status, 0);
+    }
+    TEST(P3_vmStats.freeBlocks, blocks);
+    Sys_VmShutdown();
+    PASSED();
+    return 0;
+}
+
+
+void test_setup(int argc, char **argv) {
+}
+
+void test_cleanup(int argc, char **argv) {
+    if (passed) {
+        USLOSS_Console("TEST PASSED.\n");
+    }
+}
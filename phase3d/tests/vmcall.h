@@ -0,0 +1,71 @@
+/*
+ * vmcall.h
+ *
+ *  P3_VmClone and P3_VmSetLimit can only be called in kernel mode, and there are no
+ *  system calls for them. A test that uses them calls VmCallInit after Sys_VmInit, which
+ *  puts VmCallHandler in front of the system call interrupt handler. VmCallHandler
+ *  handles the system call numbers below, which no real system call uses, and passes
+ *  everything else on.
+ *
+ */
+#ifndef _VMCALL_H_
+#define _VMCALL_H_
+
+#include <usloss.h>
+#include <phase3.h>
+
+#define SYS_VMCLONE     100     // not real system calls, VmCallHandler handles them
+#define SYS_VMSETLIMIT  101
+
+static void (*vmCallNext)(int type, void *arg);
+
+static void
+VmCallHandler(int type, void *arg)
+{
+    USLOSS_Sysargs *sysArgs = (USLOSS_Sysargs *) arg;
+
+    switch (sysArgs->number) {
+        case SYS_VMCLONE:
+            sysArgs->arg4 = (void *) P3_VmClone((int) sysArgs->arg1, (int) sysArgs->arg2);
+            break;
+        case SYS_VMSETLIMIT:
+            sysArgs->arg4 = (void *) P3_VmSetLimit((int) sysArgs->arg1, (int) sysArgs->arg2);
+            break;
+        default:
+            vmCallNext(type, arg);
+            break;
+    }
+}
+
+static void
+VmCallInit(void)
+{
+    vmCallNext = USLOSS_IntVec[USLOSS_SYSCALL_INT];
+    USLOSS_IntVec[USLOSS_SYSCALL_INT] = VmCallHandler;
+}
+
+static int
+Sys_VmClone(int parent, int child)
+{
+    USLOSS_Sysargs sysArgs;
+
+    sysArgs.number = SYS_VMCLONE;
+    sysArgs.arg1 = (void *) parent;
+    sysArgs.arg2 = (void *) child;
+    USLOSS_Syscall((void *) &sysArgs);
+    return (int) sysArgs.arg4;
+}
+
+static int
+Sys_VmSetLimit(int pid, int frames)
+{
+    USLOSS_Sysargs sysArgs;
+
+    sysArgs.number = SYS_VMSETLIMIT;
+    sysArgs.arg1 = (void *) pid;
+    sysArgs.arg2 = (void *) frames;
+    USLOSS_Syscall((void *) &sysArgs);
+    return (int) sysArgs.arg4;
+}
+
+#endif /* _VMCALL_H_ */